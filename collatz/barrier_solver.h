@@ -0,0 +1,937 @@
+#pragma once
+
+#include "linear_solver.h"
+#include "system_file.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+
+#ifndef BARRIER_TOLERANCE
+#define BARRIER_TOLERANCE 1e-8L
+#endif
+
+#ifndef BARRIER_ITERATIONS
+#define BARRIER_ITERATIONS 200
+#endif
+
+#ifndef BARRIER_STALL
+#define BARRIER_STALL 5
+#endif
+
+// 1 until the factorization is timed on more than one core; set it to e.g.
+// std::thread::hardware_concurrency() to try the parallel blocks and tiles
+#ifndef BARRIER_THREADS
+#define BARRIER_THREADS 1
+#endif
+
+// below this width of the dense tail, which carries most of the flops, the
+// factorization is too small to pay for waking the threads
+#ifndef BARRIER_PARALLEL_TAIL
+#define BARRIER_PARALLEL_TAIL 256
+#endif
+
+#ifndef BARRIER_TILE
+#define BARRIER_TILE 32
+#endif
+
+class NotConverged : std::logic_error {
+public:
+	NotConverged() : std::logic_error("NotConverged") {}
+};
+
+// threads - 1 threads that wait for work as long as the pool lives; Run hands
+// out task(item, worker) for every item < count to them and to the calling
+// thread, worker < threads numbers the thread for its own scratch memory
+class WorkerPool {
+private:
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable start_;
+	std::condition_variable done_;
+	std::function<void(size_t, size_t)> task_;
+	size_t count_;
+	std::atomic<size_t> next_;
+	size_t generation_;
+	size_t running_;
+	bool stop_;
+
+	void Drain(size_t worker) {
+		for (size_t item = next_++; item < count_; item = next_++) {
+			task_(item, worker);
+		}
+	}
+
+	void Work(size_t worker) {
+		size_t generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				start_.wait(lock, [&]() {
+					return stop_ || generation_ != generation;
+				});
+				if (stop_) {
+					return;
+				}
+				generation = generation_;
+			}
+			Drain(worker);
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (--running_ == 0) {
+				done_.notify_one();
+			}
+		}
+	}
+
+public:
+	WorkerPool(size_t threads) : count_(0), next_(0), generation_(0), running_(0), stop_(false) {
+		for (size_t worker = 1; worker < threads; ++worker) {
+			threads_.emplace_back(&WorkerPool::Work, this, worker);
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		start_.notify_all();
+		for (auto& thread : threads_) {
+			thread.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	size_t Threads() const {
+		return threads_.size() + 1;
+	}
+
+	// returns when every item is done, every thread takes part in every Run
+	template <class Task>
+	void Run(size_t count, const Task& task) {
+		if (threads_.empty() || count <= 1) {
+			for (size_t item = 0; item < count; ++item) {
+				task(item, 0);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			task_ = [&task](size_t item, size_t worker) {
+				task(item, worker);
+			};
+			count_ = count;
+			next_ = 0;
+			running_ = threads_.size();
+			++generation_;
+		}
+		start_.notify_all();
+		Drain(0);
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_.wait(lock, [&]() {
+			return running_ == 0;
+		});
+	}
+};
+
+// The symbolic part of a Cholesky factorization L * L^T of a sparse symmetric
+// positive definite matrix: elimination order, pattern of L and its blocks. It
+// depends only on the pattern of the matrix, every SparseCholesky of that
+// pattern shares one. The elimination order is chosen by minimum degree, which
+// eliminates the leaves of the residue ladder first, so the tree part of the
+// pattern factors without fill.
+//
+// Every Q-equation links residue classes (m and 4m differ mod 9), so the order
+// ends in a dense tail of coupled variables, and the elimination tree below it
+// falls apart into independent blocks, the ladder subtrees.
+class CholeskyPattern {
+private:
+	template <class T>
+	friend class SparseCholesky;
+
+	size_t size_;
+	std::vector<size_t> permutation_;  // permutation_[position] = variable
+	std::vector<size_t> inverse_;      // inverse_[variable] = position
+	std::vector<size_t> col_start_;
+	std::vector<size_t> rows_;
+
+	size_t tail_;                       // the columns from tail_ on form a dense lower triangle
+	std::vector<size_t> block_start_;   // columns of block b: block_columns_[block_start_[b]..]
+	std::vector<size_t> block_columns_;
+	std::vector<size_t> scatter_start_; // block entries in tail column col: scatter_[scatter_start_[col - tail_]..]
+	std::vector<std::pair<size_t, size_t> > scatter_;  // (entry, end of its block column)
+
+public:
+	CholeskyPattern() : size_(0), tail_(0), block_start_(1, 0), scatter_start_(1, 0) {}
+
+	// adjacency[i] lists the variables coupled with i, without i itself
+	CholeskyPattern(const std::vector<std::vector<size_t> >& adjacency) : size_(adjacency.size()) {
+		std::vector<std::vector<size_t> > graph(size_);
+		for (size_t i = 0; i < size_; ++i) {
+			for (size_t j : adjacency[i]) {
+				if (i != j) {
+					graph[i].push_back(j);
+					graph[j].push_back(i);
+				}
+			}
+		}
+		for (auto& neighbours : graph) {
+			std::sort(neighbours.begin(), neighbours.end());
+			neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		}
+
+		// MINIMUM DEGREE ORDERING
+		std::vector<std::vector<size_t> > patterns(size_);
+		std::vector<bool> eliminated(size_, false);
+		std::priority_queue<std::pair<size_t, size_t>, std::vector<std::pair<size_t, size_t> >, std::greater<> > queue;
+		for (size_t i = 0; i < size_; ++i) {
+			queue.emplace(graph[i].size(), i);
+		}
+		std::vector<size_t> merged;
+		while (!queue.empty()) {
+			auto [degree, v] = queue.top();
+			queue.pop();
+			if (eliminated[v] || degree != graph[v].size()) {
+				continue;
+			}
+			eliminated[v] = true;
+			permutation_.push_back(v);
+			patterns[v].swap(graph[v]);
+
+			// the neighbours of v become a clique
+			for (size_t u : patterns[v]) {
+				merged.clear();
+				std::set_union(graph[u].begin(), graph[u].end(), patterns[v].begin(), patterns[v].end(), std::back_inserter(merged));
+				merged.erase(std::remove_if(merged.begin(), merged.end(), [u, v](size_t w) {
+					return w == u || w == v;
+				}), merged.end());
+				graph[u].swap(merged);
+				queue.emplace(graph[u].size(), u);
+			}
+		}
+
+		inverse_.resize(size_);
+		for (size_t position = 0; position < size_; ++position) {
+			inverse_[permutation_[position]] = position;
+		}
+
+		// SYMBOLIC FACTORIZATION
+		col_start_.assign(size_ + 1, 0);
+		for (size_t col = 0; col < size_; ++col) {
+			std::vector<size_t>& pattern = patterns[permutation_[col]];
+			for (auto& variable : pattern) {
+				variable = inverse_[variable];
+			}
+			std::sort(pattern.begin(), pattern.end());
+			col_start_[col + 1] = col_start_[col] + pattern.size();
+			rows_.insert(rows_.end(), pattern.begin(), pattern.end());
+		}
+
+		// DECOMPOSITION
+		tail_ = size_;
+		while (tail_ > 0 && col_start_[tail_] - col_start_[tail_ - 1] == size_ - tail_) {
+			--tail_;
+		}
+
+		// a column below the tail belongs to the block of its elimination tree parent
+		std::vector<size_t> block(tail_);
+		std::vector<size_t> block_size;
+		for (size_t col = tail_; col-- > 0;) {
+			size_t parent = col_start_[col] < col_start_[col + 1] ? rows_[col_start_[col]] : size_;
+			if (parent < tail_) {
+				block[col] = block[parent];
+				++block_size[block[col]];
+			} else {
+				block[col] = block_size.size();
+				block_size.push_back(1);
+			}
+		}
+
+		// the largest blocks go first, the small ones fill up the workers at the end
+		std::vector<size_t> order(block_size.size());
+		for (size_t b = 0; b < order.size(); ++b) {
+			order[b] = b;
+		}
+		std::stable_sort(order.begin(), order.end(), [&block_size](size_t lhs, size_t rhs) {
+			return block_size[lhs] > block_size[rhs];
+		});
+		std::vector<size_t> rank(order.size());
+		block_start_.assign(order.size() + 1, 0);
+		for (size_t b = 0; b < order.size(); ++b) {
+			rank[order[b]] = b;
+			block_start_[b + 1] = block_start_[b] + block_size[order[b]];
+		}
+		block_columns_.resize(tail_);
+		std::vector<size_t> filled(block_start_.begin(), block_start_.end() - 1);
+		for (size_t col = 0; col < tail_; ++col) {
+			block_columns_[filled[rank[block[col]]]++] = col;
+		}
+
+		// the block entries in the tail rows, grouped by the tail column they update
+		scatter_start_.assign(size_ - tail_ + 1, 0);
+		for (size_t p = 0; p < col_start_[tail_]; ++p) {
+			if (rows_[p] >= tail_) {
+				++scatter_start_[rows_[p] - tail_ + 1];
+			}
+		}
+		for (size_t col = 0; col < size_ - tail_; ++col) {
+			scatter_start_[col + 1] += scatter_start_[col];
+		}
+		scatter_.resize(scatter_start_.back());
+		filled.assign(scatter_start_.begin(), scatter_start_.end() - 1);
+		for (size_t k = 0; k < tail_; ++k) {
+			for (size_t p = col_start_[k]; p < col_start_[k + 1]; ++p) {
+				if (rows_[p] >= tail_) {
+					scatter_[filled[rows_[p] - tail_]++] = { p, col_start_[k + 1] };
+				}
+			}
+		}
+	}
+
+	size_t Size() const {
+		return size_;
+	}
+
+	size_t NonZeroCount() const {
+		return rows_.size() + size_;
+	}
+
+	// threads worth starting for a factorization: at most one per block or tail tile
+	size_t Parallelism() const {
+		size_t width = size_ - tail_;
+		if (width < BARRIER_PARALLEL_TAIL) {
+			return 1;
+		}
+		size_t items = std::max<size_t>(block_start_.size() - 1, width / BARRIER_TILE);
+		return std::min<size_t>(std::max<size_t>(BARRIER_THREADS, 1), items);
+	}
+
+	// storage index of the off diagonal entry (i, j), both given as variables
+	size_t Position(size_t i, size_t j) const {
+		size_t col = std::min(inverse_[i], inverse_[j]);
+		size_t row = std::max(inverse_[i], inverse_[j]);
+		auto begin = rows_.begin() + col_start_[col];
+		auto end = rows_.begin() + col_start_[col + 1];
+		auto it = std::lower_bound(begin, end, row);
+		if (it == end || *it != row) {
+			throw InvalidOperation{};
+		}
+		return static_cast<size_t>(it - rows_.begin());
+	}
+};
+
+// Numeric Cholesky factorization over a CholeskyPattern. The blocks are
+// factorized in parallel, then the tail gets their Schur complement and is
+// factorized as a dense matrix by tiles of BARRIER_TILE columns.
+template <class T>
+class SparseCholesky {
+private:
+	std::shared_ptr<const CholeskyPattern> pattern_;
+	std::vector<T> values_;
+	std::vector<T> diagonal_;
+	std::vector<T> dense_;              // the tail column major, dense_[(col - tail) * width + row - tail]
+
+	T& Dense(size_t row, size_t col) {
+		return dense_[(col - pattern_->tail_) * (pattern_->size_ - pattern_->tail_) + row - pattern_->tail_];
+	}
+
+	// a pivot that vanished belongs to a dependent direction, its step is driven to zero
+	static T Pivot(T pivot, T singular) {
+		return std::sqrt(pivot <= singular ? static_cast<T>(1e64) : pivot);
+	}
+
+	// left looking factorization of the columns below the tail; a column only
+	// gets updates from its descendants, which lie in the same block
+	void FactorizeBlocks(WorkerPool& pool, T singular) {
+		std::vector<std::vector<T> > works(pool.Threads());
+		std::vector<size_t> head(pattern_->tail_, SIZE_MAX);
+		std::vector<size_t> next(pattern_->tail_, SIZE_MAX);
+		std::vector<size_t> first(pattern_->tail_);
+
+		pool.Run(pattern_->block_start_.size() - 1, [&](size_t b, size_t worker) {
+			std::vector<T>& work = works[worker];
+			work.resize(pattern_->size_, 0);
+			for (size_t i = pattern_->block_start_[b]; i < pattern_->block_start_[b + 1]; ++i) {
+				size_t col = pattern_->block_columns_[i];
+				work[col] = diagonal_[col];
+				for (size_t p = pattern_->col_start_[col]; p < pattern_->col_start_[col + 1]; ++p) {
+					work[pattern_->rows_[p]] = values_[p];
+				}
+
+				for (size_t k = head[col]; k != SIZE_MAX;) {
+					size_t following = next[k];
+					T factor = values_[first[k]];
+					for (size_t p = first[k]; p < pattern_->col_start_[k + 1]; ++p) {
+						work[pattern_->rows_[p]] -= factor * values_[p];
+					}
+					if (++first[k] < pattern_->col_start_[k + 1] && pattern_->rows_[first[k]] < pattern_->tail_) {
+						size_t row = pattern_->rows_[first[k]];
+						next[k] = head[row];
+						head[row] = k;
+					}
+					k = following;
+				}
+
+				diagonal_[col] = Pivot(work[col], singular);
+				work[col] = 0;
+				for (size_t p = pattern_->col_start_[col]; p < pattern_->col_start_[col + 1]; ++p) {
+					values_[p] = work[pattern_->rows_[p]] / diagonal_[col];
+					work[pattern_->rows_[p]] = 0;
+				}
+
+				if (pattern_->col_start_[col] < pattern_->col_start_[col + 1] && pattern_->rows_[pattern_->col_start_[col]] < pattern_->tail_) {
+					first[col] = pattern_->col_start_[col];
+					size_t row = pattern_->rows_[first[col]];
+					next[col] = head[row];
+					head[row] = col;
+				}
+			}
+		});
+	}
+
+	// the tail minus the Schur complement updates of all block columns; a worker
+	// takes one tail column at a time and reads only the block entries in its row
+	void ScatterTail(WorkerPool& pool) {
+		for (size_t col = pattern_->tail_; col < pattern_->size_; ++col) {
+			Dense(col, col) = diagonal_[col];
+			for (size_t p = pattern_->col_start_[col]; p < pattern_->col_start_[col + 1]; ++p) {
+				Dense(pattern_->rows_[p], col) = values_[p];
+			}
+		}
+
+		pool.Run(pattern_->size_ - pattern_->tail_, [&](size_t item, size_t) {
+			size_t col = pattern_->tail_ + item;
+			for (size_t i = pattern_->scatter_start_[item]; i < pattern_->scatter_start_[item + 1]; ++i) {
+				auto [p, end] = pattern_->scatter_[i];
+				T factor = values_[p];
+				for (size_t q = p; q < end; ++q) {
+					Dense(pattern_->rows_[q], col) -= factor * values_[q];
+				}
+			}
+		});
+	}
+
+	// dense column next -= L(next, col) * column col, from the diagonal down
+	void Update(size_t next, size_t col) {
+		T* target = &Dense(next, next);
+		const T* source = &Dense(next, col);
+		T factor = *source;
+		for (size_t row = next; row < pattern_->size_; ++row) {
+			*target++ -= factor * *source++;
+		}
+	}
+
+	// the same for all columns of the tile [begin, end), every entry is written once
+	void UpdateTile(size_t next, size_t begin, size_t end) {
+		T factors[BARRIER_TILE];
+		for (size_t col = begin; col < end; ++col) {
+			factors[col - begin] = Dense(next, col);
+		}
+		size_t width = pattern_->size_ - pattern_->tail_;
+		const T* source = &Dense(next, begin);
+		for (T* target = &Dense(next, next); target != &Dense(next, next) + (pattern_->size_ - next); ++target, ++source) {
+			T sum = 0;
+			for (size_t col = 0; col < end - begin; ++col) {
+				sum += factors[col] * source[col * width];
+			}
+			*target -= sum;
+		}
+	}
+
+	// dense right looking factorization: a tile of columns is factorized in place,
+	// then the columns after it are updated in parallel
+	void FactorizeTail(WorkerPool& pool, T singular) {
+		for (size_t begin = pattern_->tail_; begin < pattern_->size_; begin += BARRIER_TILE) {
+			size_t end = std::min<size_t>(begin + BARRIER_TILE, pattern_->size_);
+			for (size_t col = begin; col < end; ++col) {
+				T pivot = Pivot(Dense(col, col), singular);
+				Dense(col, col) = pivot;
+				for (size_t row = col + 1; row < pattern_->size_; ++row) {
+					Dense(row, col) /= pivot;
+				}
+				for (size_t next = col + 1; next < end; ++next) {
+					Update(next, col);
+				}
+			}
+
+			pool.Run(pattern_->size_ - end, [&](size_t item, size_t) {
+				UpdateTile(end + item, begin, end);
+			});
+		}
+	}
+
+	void GatherTail() {
+		for (size_t col = pattern_->tail_; col < pattern_->size_; ++col) {
+			diagonal_[col] = Dense(col, col);
+			for (size_t p = pattern_->col_start_[col]; p < pattern_->col_start_[col + 1]; ++p) {
+				values_[p] = Dense(pattern_->rows_[p], col);
+			}
+		}
+	}
+
+public:
+	SparseCholesky() : pattern_(std::make_shared<CholeskyPattern>()) {}
+
+	SparseCholesky(std::shared_ptr<const CholeskyPattern> pattern) :
+		pattern_(std::move(pattern)),
+		values_(pattern_->rows_.size(), 0),
+		diagonal_(pattern_->size_, 0),
+		dense_((pattern_->size_ - pattern_->tail_) * (pattern_->size_ - pattern_->tail_), 0) {}
+
+	void Clear() {
+		std::fill(values_.begin(), values_.end(), T(0));
+		std::fill(diagonal_.begin(), diagonal_.end(), T(0));
+	}
+
+	T& Diagonal(size_t variable) {
+		return diagonal_[pattern_->inverse_[variable]];
+	}
+
+	T& At(size_t position) {
+		return values_[position];
+	}
+
+	// the matrix entries are replaced by L: left looking inside the blocks,
+	// right looking by tiles in the dense tail
+	void Factorize(WorkerPool& pool) {
+		T largest = 0;
+		for (T value : diagonal_) {
+			largest = std::max(largest, value);
+		}
+		T singular = largest * std::numeric_limits<T>::epsilon();
+
+		FactorizeBlocks(pool, singular);
+		ScatterTail(pool);
+		FactorizeTail(pool, singular);
+		GatherTail();
+	}
+
+	std::vector<T> Solve(const std::vector<T>& rhs) const {
+		std::vector<T> solution(pattern_->size_);
+		for (size_t position = 0; position < pattern_->size_; ++position) {
+			solution[position] = rhs[pattern_->permutation_[position]];
+		}
+		for (size_t col = 0; col < pattern_->size_; ++col) {
+			solution[col] /= diagonal_[col];
+			for (size_t p = pattern_->col_start_[col]; p < pattern_->col_start_[col + 1]; ++p) {
+				solution[pattern_->rows_[p]] -= values_[p] * solution[col];
+			}
+		}
+		for (size_t col = pattern_->size_; col-- > 0;) {
+			for (size_t p = pattern_->col_start_[col]; p < pattern_->col_start_[col + 1]; ++p) {
+				solution[col] -= values_[p] * solution[pattern_->rows_[p]];
+			}
+			solution[col] /= diagonal_[col];
+		}
+
+		std::vector<T> result(pattern_->size_);
+		for (size_t position = 0; position < pattern_->size_; ++position) {
+			result[pattern_->permutation_[position]] = solution[position];
+		}
+		return result;
+	}
+};
+
+// the part of the normal matrix A^T W^-1 Y A that depends only on the pattern
+// of A: its Cholesky pattern and, for every pair of entries of a row, the
+// position of their product in L (SIZE_MAX for a product on the diagonal)
+struct NormalPattern {
+	std::shared_ptr<const CholeskyPattern> cholesky;
+	std::vector<size_t> pair_start;
+	std::vector<size_t> pair_positions;
+
+	NormalPattern(const std::vector<size_t>& row_start, const std::vector<size_t>& columns, size_t variable_count) {
+		std::vector<std::vector<size_t> > adjacency(variable_count);
+		for (size_t row = 0; row + 1 < row_start.size(); ++row) {
+			for (size_t p = row_start[row]; p < row_start[row + 1]; ++p) {
+				for (size_t q = p + 1; q < row_start[row + 1]; ++q) {
+					adjacency[columns[p]].push_back(columns[q]);
+				}
+			}
+		}
+		cholesky = std::make_shared<CholeskyPattern>(adjacency);
+
+		pair_start.push_back(0);
+		for (size_t row = 0; row + 1 < row_start.size(); ++row) {
+			for (size_t p = row_start[row]; p < row_start[row + 1]; ++p) {
+				for (size_t q = p + 1; q < row_start[row + 1]; ++q) {
+					pair_positions.push_back(columns[p] == columns[q] ? SIZE_MAX : cholesky->Position(columns[p], columns[q]));
+				}
+			}
+			pair_start.push_back(pair_positions.size());
+		}
+	}
+};
+
+// the NormalPattern of a mapped system, built once per SystemHash for the whole
+// run: the minimum degree ordering depends only on k, and every probe and every
+// margin solve of the same k would repeat it
+inline std::shared_ptr<const NormalPattern> SharedNormalPattern(uint64_t source_hash, const std::vector<size_t>& row_start, const std::vector<size_t>& columns, size_t variable_count) {
+	static std::mutex mutex;
+	static std::map<std::pair<uint64_t, size_t>, std::shared_ptr<const NormalPattern> > patterns;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<const NormalPattern>& pattern = patterns[{ source_hash, variable_count }];
+	if (!pattern) {
+		pattern = std::make_shared<NormalPattern>(row_start, columns, variable_count);
+	}
+	return pattern;
+}
+
+// Primal-dual path following method for max c*x, A*x <= b, x >= 0 with the same
+// interface as Solver. Every iteration solves the normal equations
+//   (X^-1 Z + A^T W^-1 Y A) dx = r
+// in the space of the original variables with SparseCholesky.
+template <class T>
+class BarrierSolver {
+private:
+	size_t variable_count_;
+	std::vector<size_t> row_start_;
+	std::vector<size_t> columns_;
+	std::vector<T> values_;
+	std::vector<T> results_;
+	std::vector<T> objective_;
+
+	std::shared_ptr<const NormalPattern> pattern_;
+	SparseCholesky<T> normal_;
+	std::unique_ptr<WorkerPool> pool_;  // started once per solver, used by every Factorize
+
+	std::vector<T> x_;
+	std::vector<T> w_;
+	std::vector<T> y_;
+	std::vector<T> z_;
+
+	void AddRow(const std::vector<std::pair<size_t, T> >& entries, T result) {
+		for (auto [column, value] : entries) {
+			columns_.push_back(column);
+			values_.push_back(value);
+		}
+		results_.push_back(result);
+		row_start_.push_back(columns_.size());
+	}
+
+	void AddEquation(const Equation<T>& equation) {
+		std::vector<std::pair<size_t, T> > entries;
+		std::vector<T> coefitients = equation.GetCoefitients();
+		T sign = equation.IsGreaterInequality() ? -1 : 1;
+		for (size_t col = 0; col < coefitients.size(); ++col) {
+			if (coefitients[col] != 0) {
+				entries.emplace_back(col, sign * coefitients[col]);
+			}
+		}
+		AddRow(entries, sign * equation.GetResult());
+
+		if (equation.IsEquality()) {
+			for (auto& entry : entries) {
+				entry.second = -entry.second;
+			}
+			AddRow(entries, -equation.GetResult());
+		}
+	}
+
+	void SetObjective(const Equation<T>& max_equation) {
+		objective_ = max_equation.GetCoefitients();
+		objective_.resize(variable_count_, 0);
+	}
+
+	void Prepare(std::shared_ptr<const NormalPattern> pattern) {
+		pattern_ = std::move(pattern);
+		normal_ = SparseCholesky<T>(pattern_->cholesky);
+		pool_ = std::make_unique<WorkerPool>(pattern_->cholesky->Parallelism());
+
+		x_.assign(variable_count_, 1);
+		z_.assign(variable_count_, 1);
+		w_.assign(RowCount(), 1);
+		y_.assign(RowCount(), 1);
+	}
+
+	size_t RowCount() const {
+		return results_.size();
+	}
+
+	// y = A * x
+	std::vector<T> Multiply(const std::vector<T>& x) const {
+		std::vector<T> y(RowCount(), 0);
+		for (size_t row = 0; row < RowCount(); ++row) {
+			for (size_t p = row_start_[row]; p < row_start_[row + 1]; ++p) {
+				y[row] += values_[p] * x[columns_[p]];
+			}
+		}
+		return y;
+	}
+
+	// x = A^T * y
+	std::vector<T> MultiplyTransposed(const std::vector<T>& y) const {
+		std::vector<T> x(variable_count_, 0);
+		for (size_t row = 0; row < RowCount(); ++row) {
+			for (size_t p = row_start_[row]; p < row_start_[row + 1]; ++p) {
+				x[columns_[p]] += values_[p] * y[row];
+			}
+		}
+		return x;
+	}
+
+	void AssembleNormal() {
+		normal_.Clear();
+		for (size_t col = 0; col < variable_count_; ++col) {
+			normal_.Diagonal(col) += z_[col] / x_[col];
+		}
+		for (size_t row = 0; row < RowCount(); ++row) {
+			T weight = y_[row] / w_[row];
+			size_t pair = pattern_->pair_start[row];
+			for (size_t p = row_start_[row]; p < row_start_[row + 1]; ++p) {
+				normal_.Diagonal(columns_[p]) += weight * values_[p] * values_[p];
+				for (size_t q = p + 1; q < row_start_[row + 1]; ++q, ++pair) {
+					if (pattern_->pair_positions[pair] == SIZE_MAX) {
+						normal_.Diagonal(columns_[p]) += 2 * weight * values_[p] * values_[q];
+					} else {
+						normal_.At(pattern_->pair_positions[pair]) += weight * values_[p] * values_[q];
+					}
+				}
+			}
+		}
+	}
+
+	struct Direction {
+		std::vector<T> dx;
+		std::vector<T> dw;
+		std::vector<T> dy;
+		std::vector<T> dz;
+	};
+
+	// Newton direction for the residuals rho = b - A*x - w, sigma = c - A^T*y + z and the
+	// complementarity targets Z*dx + X*dz = xz, W*dy + Y*dw = yw, normal_ must be factorized
+	Direction Solve(const std::vector<T>& rho, const std::vector<T>& sigma, const std::vector<T>& xz, const std::vector<T>& yw) const {
+		size_t n = variable_count_;
+		size_t m = RowCount();
+		Direction direction;
+
+		std::vector<T> primal_rhs(m);
+		std::vector<T> weighted(m);
+		for (size_t row = 0; row < m; ++row) {
+			primal_rhs[row] = rho[row] - yw[row] / y_[row];
+			weighted[row] = y_[row] / w_[row] * primal_rhs[row];
+		}
+		std::vector<T> rhs = MultiplyTransposed(weighted);
+		for (size_t col = 0; col < n; ++col) {
+			rhs[col] += sigma[col] + xz[col] / x_[col];
+		}
+
+		direction.dx = normal_.Solve(rhs);
+		std::vector<T> adx = Multiply(direction.dx);
+		direction.dy.resize(m);
+		direction.dw.resize(m);
+		direction.dz.resize(n);
+		for (size_t row = 0; row < m; ++row) {
+			direction.dy[row] = y_[row] / w_[row] * (adx[row] - primal_rhs[row]);
+			direction.dw[row] = (yw[row] - w_[row] * direction.dy[row]) / y_[row];
+		}
+		for (size_t col = 0; col < n; ++col) {
+			direction.dz[col] = (xz[col] - z_[col] * direction.dx[col]) / x_[col];
+		}
+		return direction;
+	}
+
+	// largest -step / value, the step is admissible up to 1 / StepLength
+	static T StepLength(const std::vector<T>& value, const std::vector<T>& step, T bound) {
+		for (size_t i = 0; i < value.size(); ++i) {
+			bound = std::max(bound, -step[i] / value[i]);
+		}
+		return bound;
+	}
+
+public:
+	BarrierSolver(const std::vector<Equation<T> >& equations, const Equation<T>& max_equation) :
+		variable_count_(max_equation.VariableCount()),
+		row_start_(1, 0)
+	{
+		for (const auto& equation : equations) {
+			variable_count_ = std::max(variable_count_, equation.VariableCount());
+			AddEquation(equation);
+		}
+		SetObjective(max_equation);
+		Prepare(std::make_shared<NormalPattern>(row_start_, columns_, variable_count_));
+	}
+
+	// reads the rows straight from the mapped CSR arrays, the dense system is never built
+	BarrierSolver(const MappedSystem& system, long double lambda, const Equation<T>& max_equation) :
+		variable_count_(std::max(system.VariableCount(), max_equation.VariableCount())),
+		row_start_(1, 0)
+	{
+		std::vector<T> slots(system.SlotCount());
+		for (size_t slot = 0; slot < slots.size(); ++slot) {
+			slots[slot] = static_cast<T>(-std::pow(lambda, -static_cast<long double>(system.Alphas()[slot])));
+		}
+
+		const SystemEntry* entries = system.Entries();
+		const uint64_t* row_offsets = system.RowOffsets();
+		for (size_t row = 0; row < system.RowCount(); ++row) {
+			std::vector<std::pair<size_t, T> > row_entries;
+			for (uint64_t i = row_offsets[row]; i < row_offsets[row + 1]; ++i) {
+				T value = entries[i].slot < 0 ? static_cast<T>(entries[i].value) : slots[entries[i].slot];
+				row_entries.emplace_back(entries[i].column, value);
+			}
+			EquationType type = static_cast<EquationType>(system.Types()[row]);
+			T result = static_cast<T>(system.Results()[row]);
+			if (type == EquationType::LESS || type == EquationType::LESS_OR_EQUAL) {
+				AddRow(row_entries, result);
+			} else {
+				for (auto& entry : row_entries) {
+					entry.second = -entry.second;
+				}
+				AddRow(row_entries, -result);
+				if (type == EquationType::EQUAL) {
+					for (auto& entry : row_entries) {
+						entry.second = -entry.second;
+					}
+					AddRow(row_entries, result);
+				}
+			}
+		}
+		SetObjective(max_equation);
+		Prepare(SharedNormalPattern(system.SourceHash(), row_start_, columns_, variable_count_));
+	}
+
+	T GetMaxim() {
+		const T ratio = static_cast<T>(0.99);
+		size_t n = variable_count_;
+		size_t m = RowCount();
+
+		T b_norm = 1;
+		for (T result : results_) {
+			b_norm = std::max(b_norm, std::abs(result));
+		}
+		T c_norm = 1;
+		for (T coefitient : objective_) {
+			c_norm = std::max(c_norm, std::abs(coefitient));
+		}
+
+		size_t stalled = 0;
+		for (size_t iteration = 0; iteration < BARRIER_ITERATIONS; ++iteration) {
+			std::vector<T> ax = Multiply(x_);
+			std::vector<T> aty = MultiplyTransposed(y_);
+
+			// RESIDUALS
+			T primal_value = 0;
+			T primal_infeasibility = 0;
+			T dual_infeasibility = 0;
+			T dual_scale = c_norm;
+			T gap = 0;
+			std::vector<T> rho(m);
+			std::vector<T> sigma(n);
+			for (size_t row = 0; row < m; ++row) {
+				rho[row] = results_[row] - ax[row] - w_[row];
+				primal_infeasibility = std::max(primal_infeasibility, std::abs(rho[row]));
+				gap += y_[row] * w_[row];
+			}
+			for (size_t col = 0; col < n; ++col) {
+				sigma[col] = objective_[col] - aty[col] + z_[col];
+				dual_infeasibility = std::max(dual_infeasibility, std::abs(sigma[col]));
+				dual_scale = std::max(dual_scale, std::max(std::abs(aty[col]), z_[col]));
+				gap += z_[col] * x_[col];
+				primal_value += objective_[col] * x_[col];
+			}
+
+#ifdef DEBUG
+			std::cout << "barrier " << iteration << " : value = " << primal_value <<
+				" primal = " << primal_infeasibility << " dual = " << dual_infeasibility <<
+				" gap = " << gap << std::endl;
+#endif // DEBUG
+
+			if (primal_infeasibility <= BARRIER_TOLERANCE * b_norm &&
+				gap <= BARRIER_TOLERANCE * (1 + std::abs(primal_value))) {
+				// at a critical lambda the dual optimum is not attained and the dual
+				// residual stalls, the primal point is accepted once it stops moving
+				if (dual_infeasibility <= BARRIER_TOLERANCE * dual_scale || ++stalled > BARRIER_STALL) {
+					return primal_value;
+				}
+			} else {
+				stalled = 0;
+			}
+
+			AssembleNormal();
+			normal_.Factorize(*pool_);
+
+			// PREDICTOR (pure Newton direction to the optimum)
+			std::vector<T> xz(n);
+			std::vector<T> yw(m);
+			for (size_t col = 0; col < n; ++col) {
+				xz[col] = -x_[col] * z_[col];
+			}
+			for (size_t row = 0; row < m; ++row) {
+				yw[row] = -y_[row] * w_[row];
+			}
+			Direction direction = Solve(rho, sigma, xz, yw);
+
+			T primal_step = std::min(T(1), 1 / StepLength(w_, direction.dw, StepLength(x_, direction.dx, 0)));
+			T dual_step = std::min(T(1), 1 / StepLength(z_, direction.dz, StepLength(y_, direction.dy, 0)));
+			T predicted_gap = 0;
+			for (size_t col = 0; col < n; ++col) {
+				predicted_gap += (x_[col] + primal_step * direction.dx[col]) * (z_[col] + dual_step * direction.dz[col]);
+			}
+			for (size_t row = 0; row < m; ++row) {
+				predicted_gap += (w_[row] + primal_step * direction.dw[row]) * (y_[row] + dual_step * direction.dy[row]);
+			}
+
+			// CORRECTOR (Mehrotra centering and second order term)
+			T centering = predicted_gap / gap;
+			T mu = centering * centering * centering * gap / static_cast<T>(n + m);
+			for (size_t col = 0; col < n; ++col) {
+				xz[col] += mu - direction.dx[col] * direction.dz[col];
+			}
+			for (size_t row = 0; row < m; ++row) {
+				yw[row] += mu - direction.dy[row] * direction.dw[row];
+			}
+			direction = Solve(rho, sigma, xz, yw);
+
+			// STEP
+			primal_step = std::min(T(1), ratio / StepLength(w_, direction.dw, StepLength(x_, direction.dx, 0)));
+			dual_step = std::min(T(1), ratio / StepLength(z_, direction.dz, StepLength(y_, direction.dy, 0)));
+			for (size_t col = 0; col < n; ++col) {
+				x_[col] += primal_step * direction.dx[col];
+				z_[col] += dual_step * direction.dz[col];
+			}
+			for (size_t row = 0; row < m; ++row) {
+				w_[row] += primal_step * direction.dw[row];
+				y_[row] += dual_step * direction.dy[row];
+			}
+		}
+
+		throw NotConverged{};
+	}
+
+	std::vector<T> GetSolution() const {
+		return x_;
+	}
+
+	// one value per stored row: a >= row is stored negated and an = row as two
+	// rows, so only a system of <= rows maps one to one onto its equations
+	std::vector<T> GetDuals() const {
+		return y_;
+	}
+
+	// columns that look basic at the barrier optimum, largest first, for Solver::WarmStart
+	std::vector<size_t> GetBasis() const {
+		std::vector<size_t> basis;
+		for (size_t col = 0; col < variable_count_; ++col) {
+			if (x_[col] > z_[col]) {
+				basis.push_back(col);
+			}
+		}
+		std::sort(basis.begin(), basis.end(), [this](size_t lhs, size_t rhs) {
+			return x_[lhs] > x_[rhs];
+		});
+		return basis;
+	}
+};
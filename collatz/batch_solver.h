@@ -0,0 +1,294 @@
+#pragma once
+
+#include "small_system.h"
+#include <array>
+#include <vector>
+
+// SmallSolver for W values of lambda at once. The tableau is a struct of
+// arrays: every entry keeps the W lanes side by side, so each step of the
+// rotation is one loop over the lanes, which the compiler vectorizes when T is
+// a double (long double is one with MSVC), and it runs only over the columns
+// where the pivot row is nonzero. The instances share the pattern, so
+// all lanes follow the pivots of the first running lane, the leader, as long
+// as the pivot is admissible in the lane. A lane where it is not is split off
+// and finished by a scalar SmallSolver; a lane that is done shadows the leader.
+// W tableaus do not fit the stack for K = SMALL_K, the batch lives on the heap.
+
+#ifndef BATCH_WIDTH
+#define BATCH_WIDTH 4
+#endif
+
+template <size_t K, size_t W = BATCH_WIDTH, class T = long double>
+class BatchSolver {
+private:
+	using Layout = SmallSystemLayout<K>;
+	using Lanes = std::array<T, W>;
+	static constexpr size_t ROWS = Layout::ROW_COUNT;
+	static constexpr size_t COLS = Layout::VARIABLE_COUNT;
+
+	std::vector<Lanes> system_;  // system_[row * COLS + col][lane]
+	std::vector<Lanes> results_;
+	std::vector<Lanes> contribution_;
+	Lanes contribution_result_;
+	std::array<size_t, ROWS> basis_;
+	std::array<size_t, COLS> nonbasis_;
+
+	std::array<bool, W> running_;
+	std::array<T, W> maxima_;
+	std::vector<size_t> pivot_pattern_;  // columns of the pivot row nonzero in some lane
+
+	Lanes& At(size_t row, size_t col) {
+		return system_[row * COLS + col];
+	}
+
+	bool IsOptimal(size_t lane) const {
+		for (size_t col = 0; col < COLS; ++col) {
+			if (contribution_[col][lane] > DUAL_TOLERANCE) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Harris bound of the first pass of the ratio test, false for an unbounded column
+	bool FindBound(size_t lane, size_t pivot_col, T& bound) {
+		bool find_bound = false;
+		for (size_t row = 0; row < ROWS; ++row) {
+			T pivot = At(row, pivot_col)[lane];
+			if (pivot <= PIVOT_TOLERANCE) {
+				continue;
+			}
+			T ratio = (results_[row][lane] + PRIMAL_TOLERANCE) / pivot;
+			if (!find_bound || ratio < bound) {
+				bound = ratio;
+				find_bound = true;
+			}
+		}
+		return find_bound;
+	}
+
+	// the pivot SmallSolver::GetMaxim would take in the lane, which must not be optimal
+	void FindPivot(size_t lane, size_t& pivot_row, size_t& pivot_col) {
+		pivot_col = 0;
+		for (size_t col = 1; col < COLS; ++col) {
+			if (contribution_[col][lane] > contribution_[pivot_col][lane] ||
+				(contribution_[col][lane] == contribution_[pivot_col][lane] && nonbasis_[col] < nonbasis_[pivot_col])) {
+				pivot_col = col;
+			}
+		}
+
+		T bound = 0;
+		if (!FindBound(lane, pivot_col, bound)) {
+			throw SystemUnbounded{};
+		}
+
+		pivot_row = 0;
+		T max_pivot = 0;
+		for (size_t row = 0; row < ROWS; ++row) {
+			T pivot = At(row, pivot_col)[lane];
+			if (pivot <= PIVOT_TOLERANCE || results_[row][lane] / pivot > bound) {
+				continue;
+			}
+			if (pivot > max_pivot) {
+				max_pivot = pivot;
+				pivot_row = row;
+			}
+		}
+	}
+
+	// any improving column with a row that passes the ratio test is a valid
+	// simplex step, the lane does not need to agree with the choice of the leader
+	bool IsAdmissible(size_t lane, size_t pivot_row, size_t pivot_col) {
+		T pivot = At(pivot_row, pivot_col)[lane];
+		T bound = 0;
+		return contribution_[pivot_col][lane] > DUAL_TOLERANCE &&
+			pivot > PIVOT_TOLERANCE &&
+			FindBound(lane, pivot_col, bound) &&
+			results_[pivot_row][lane] / pivot <= bound;
+	}
+
+	// the lane continues alone from its current tableau
+	T Split(size_t lane) {
+		SmallSolver<K, T> solver;
+		for (size_t row = 0; row < ROWS; ++row) {
+			for (size_t col = 0; col < COLS; ++col) {
+				solver.system_[row][col] = At(row, col)[lane];
+			}
+			solver.results_[row] = results_[row][lane];
+		}
+		for (size_t col = 0; col < COLS; ++col) {
+			solver.contribution_[col] = contribution_[col][lane];
+		}
+		solver.contribution_result_ = contribution_result_[lane];
+		solver.basis_ = basis_;
+		solver.nonbasis_ = nonbasis_;
+		return solver.GetMaxim();
+	}
+
+	// the stopped lanes take the values of the leader, so the rotation never
+	// divides by a pivot of a lane that went its own way
+	void Shadow(size_t leader) {
+		for (size_t lane = 0; lane < W; ++lane) {
+			if (running_[lane]) {
+				continue;
+			}
+			for (auto& entry : system_) {
+				entry[lane] = entry[leader];
+			}
+			for (auto& result : results_) {
+				result[lane] = result[leader];
+			}
+			for (auto& contribution : contribution_) {
+				contribution[lane] = contribution[leader];
+			}
+			contribution_result_[lane] = contribution_result_[leader];
+		}
+	}
+
+	void Rotate(size_t pivot_row, size_t pivot_col) {
+		Lanes pivot = At(pivot_row, pivot_col);
+		for (size_t lane = 0; lane < W; ++lane) {
+			if (results_[pivot_row][lane] < 0) {
+				results_[pivot_row][lane] = 0;
+			}
+		}
+		pivot_pattern_.clear();
+		for (size_t col = 0; col < COLS; ++col) {
+			bool zero = true;
+			for (size_t lane = 0; lane < W; ++lane) {
+				At(pivot_row, col)[lane] /= pivot[lane];
+				zero = zero && At(pivot_row, col)[lane] == 0;
+			}
+			if (!zero && col != pivot_col) {
+				pivot_pattern_.push_back(col);
+			}
+		}
+		for (size_t lane = 0; lane < W; ++lane) {
+			results_[pivot_row][lane] /= pivot[lane];
+			At(pivot_row, pivot_col)[lane] = 1 / pivot[lane];
+		}
+
+		for (size_t row = 0; row < ROWS; ++row) {
+			Lanes factor = At(row, pivot_col);
+			if (row == pivot_row) {
+				continue;
+			}
+			bool zero = true;
+			for (size_t lane = 0; lane < W; ++lane) {
+				zero = zero && factor[lane] == 0;
+			}
+			if (zero) {
+				continue;
+			}
+			for (size_t col : pivot_pattern_) {
+				for (size_t lane = 0; lane < W; ++lane) {
+					At(row, col)[lane] -= At(pivot_row, col)[lane] * factor[lane];
+				}
+			}
+			for (size_t lane = 0; lane < W; ++lane) {
+				results_[row][lane] -= results_[pivot_row][lane] * factor[lane];
+				At(row, pivot_col)[lane] = -factor[lane] / pivot[lane];
+			}
+		}
+
+		Lanes factor = contribution_[pivot_col];
+		for (size_t col : pivot_pattern_) {
+			for (size_t lane = 0; lane < W; ++lane) {
+				contribution_[col][lane] -= At(pivot_row, col)[lane] * factor[lane];
+			}
+		}
+		for (size_t lane = 0; lane < W; ++lane) {
+			contribution_result_[lane] -= results_[pivot_row][lane] * factor[lane];
+			contribution_[pivot_col][lane] = -factor[lane] / pivot[lane];
+		}
+
+		std::swap(basis_[pivot_row], nonbasis_[pivot_col]);
+	}
+
+public:
+	BatchSolver(const std::array<long double, W>& lambdas) :
+		system_(ROWS * COLS),
+		results_(ROWS),
+		contribution_(COLS)
+	{
+		std::array<long double, 3> alphas = SmallSlotAlphas();
+
+		for (size_t row = 0; row < ROWS; ++row) {
+			for (size_t col = 0; col < COLS; ++col) {
+				At(row, col).fill(0);
+			}
+			for (size_t i = 0; i < SmallSystem<K>::layout.sizes[row]; ++i) {
+				const SmallEntry& entry = SmallSystem<K>::layout.entries[row][i];
+				for (size_t lane = 0; lane < W; ++lane) {
+					At(row, entry.column)[lane] = entry.slot < 0 ?
+						static_cast<T>(entry.value) :
+						static_cast<T>(-std::pow(lambdas[lane], -alphas[entry.slot]));
+				}
+			}
+			results_[row].fill(static_cast<T>(SmallSystem<K>::layout.results[row]));
+			basis_[row] = COLS + row;
+		}
+
+		for (size_t col = 0; col < COLS; ++col) {
+			contribution_[col].fill(0);
+			nonbasis_[col] = col;
+		}
+		contribution_[0].fill(1);
+		contribution_result_.fill(0);
+		running_.fill(true);
+		maxima_.fill(0);
+	}
+
+	// the maximum of every lane; the pivot sequence may differ from W calls of
+	// SmallSolver::GetMaxim, the optimum does not
+	std::array<T, W> GetMaxim() {
+		while (true) {
+			size_t leader = W;
+			size_t pivot_row = 0;
+			size_t pivot_col = 0;
+			bool stopped = false;
+			for (size_t lane = 0; lane < W; ++lane) {
+				if (!running_[lane]) {
+					continue;
+				}
+				if (IsOptimal(lane)) {
+					maxima_[lane] = -contribution_result_[lane];
+				} else if (leader == W) {
+					leader = lane;
+					FindPivot(lane, pivot_row, pivot_col);
+					continue;
+				} else if (!IsAdmissible(lane, pivot_row, pivot_col)) {
+					maxima_[lane] = Split(lane);
+				} else {
+					continue;
+				}
+				running_[lane] = false;
+				stopped = true;
+			}
+			if (leader == W) {
+				return maxima_;
+			}
+			if (stopped) {
+				Shadow(leader);
+			}
+
+			Rotate(pivot_row, pivot_col);
+
+			stopped = false;
+			for (size_t lane = 0; lane < W; ++lane) {
+				if (running_[lane] && contribution_result_[lane] < -THRESHOLD) {
+					maxima_[lane] = 1;
+					running_[lane] = false;
+					stopped = true;
+				}
+			}
+			if (stopped) {
+				for (leader = 0; leader < W && !running_[leader]; ++leader) {}
+				if (leader == W) {
+					return maxima_;
+				}
+				Shadow(leader);
+			}
+		}
+	}
+};
@@ -0,0 +1,126 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const char CHECKPOINT_MAGIC[8] = { 'C', 'L', 'Z', 'C', 'K', 'P', 'T', 0 };
+
+Checkpoint::Checkpoint(const std::string& path, size_t k, uint64_t source_hash, uint64_t solver_mode) :
+	path_(path),
+	temp_path_(TempPath(path)),
+	k_(k),
+	source_hash_(source_hash),
+	solver_mode_(solver_mode),
+	resumed_(false),
+	iteration_(0),
+	min_lambda_(1),
+	max_lambda_(2),
+	lambda_(0),
+	newton_(true),
+	has_solver_(false),
+	last_save_(std::chrono::steady_clock::now()) {}
+
+Checkpoint::Checkpoint() : Checkpoint("", 0, 0, 0) {}
+
+bool Checkpoint::Due() const {
+	return !path_.empty() && std::chrono::steady_clock::now() - last_save_ >= std::chrono::seconds(CHECKPOINT_PERIOD);
+}
+
+std::ofstream Checkpoint::Open() const {
+	std::ofstream out(temp_path_, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		throw InvalidCheckpoint{};
+	}
+
+	CheckpointHeader header{};
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.k = static_cast<uint32_t>(k_);
+	header.iteration = iteration_;
+	header.has_solver = has_solver_;
+	header.min_lambda = min_lambda_;
+	header.max_lambda = max_lambda_;
+	header.lambda = lambda_;
+	header.newton = newton_;
+	header.source_hash = source_hash_;
+	header.solver_mode = solver_mode_;
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	return out;
+}
+
+void Checkpoint::Commit(std::ofstream& out) {
+	out.close();
+	if (!out || !AtomicRename(temp_path_, path_)) {
+		throw InvalidCheckpoint{};
+	}
+	last_save_ = std::chrono::steady_clock::now();
+}
+
+bool Checkpoint::Load() {
+	std::ifstream in(path_, std::ios::binary);
+	CheckpointHeader header{};
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != CHECKPOINT_VERSION ||
+		header.k != k_ ||
+		header.source_hash != source_hash_ ||
+		header.solver_mode != solver_mode_) {
+		return false;
+	}
+
+	resumed_ = true;
+	iteration_ = static_cast<size_t>(header.iteration);
+	has_solver_ = header.has_solver != 0;
+	min_lambda_ = header.min_lambda;
+	max_lambda_ = header.max_lambda;
+	lambda_ = header.lambda;
+	newton_ = header.newton != 0;
+	return true;
+}
+
+bool Checkpoint::Resumed() const {
+	return resumed_;
+}
+
+size_t Checkpoint::GetIteration() const {
+	return iteration_;
+}
+
+long double Checkpoint::GetMinLambda() const {
+	return min_lambda_;
+}
+
+long double Checkpoint::GetMaxLambda() const {
+	return max_lambda_;
+}
+
+bool Checkpoint::GetNewton() const {
+	return newton_;
+}
+
+bool Checkpoint::HasSolver(long double lambda) const {
+	return has_solver_ && lambda_ == lambda;
+}
+
+void Checkpoint::SetBracket(size_t iteration, long double min_lambda, long double max_lambda, bool newton) {
+	iteration_ = iteration;
+	min_lambda_ = min_lambda;
+	max_lambda_ = max_lambda;
+	newton_ = newton;
+	has_solver_ = false;
+}
+
+void Checkpoint::Save() {
+	if (!Due()) {
+		return;
+	}
+	std::ofstream out = Open();
+	Commit(out);
+}
+
+void Checkpoint::Remove() {
+	if (path_.empty()) {
+		return;
+	}
+	std::remove(path_.c_str());
+}
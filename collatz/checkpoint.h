@@ -0,0 +1,102 @@
+#pragma once
+
+#include "linear_solver.h"
+#include "system_file.h"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Checkpoint file (version 4):
+//   CheckpointHeader
+//   Solver<T>::Save output, present only if has_solver != 0
+// The file always holds one consistent snapshot, it is replaced by AtomicRename.
+
+#define CHECKPOINT_VERSION 4
+
+#ifndef CHECKPOINT_PERIOD
+#define CHECKPOINT_PERIOD 600
+#endif
+
+class InvalidCheckpoint : std::logic_error {
+public:
+	InvalidCheckpoint() : std::logic_error("InvalidCheckpoint") {}
+};
+
+struct CheckpointHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t k;
+	uint64_t iteration;
+	uint64_t has_solver;
+	long double min_lambda;
+	long double max_lambda;
+	long double lambda;
+	uint64_t newton;  // N tries a Newton step next, otherwise bisection
+	uint64_t source_hash;  // SystemHash of the rows of the system
+	uint64_t solver_mode;  // build options that change the saved tableau
+};
+
+class Checkpoint {
+private:
+	std::string path_;
+	std::string temp_path_;
+	size_t k_;
+	uint64_t source_hash_;
+	uint64_t solver_mode_;
+	bool resumed_;
+	size_t iteration_;
+	long double min_lambda_;
+	long double max_lambda_;
+	long double lambda_;
+	bool newton_;
+	bool has_solver_;
+	std::chrono::steady_clock::time_point last_save_;
+
+	bool Due() const;
+	std::ofstream Open() const;
+	void Commit(std::ofstream& out);
+
+public:
+	// only a file saved for the same k, rows and solver mode is loaded
+	Checkpoint(const std::string& path, size_t k, uint64_t source_hash, uint64_t solver_mode);
+	// a checkpoint that is never written, for runs that cannot be resumed
+	Checkpoint();
+
+	// reads the bracket (and solver state if any), false for a missing file or
+	// one saved for another system or solver mode
+	bool Load();
+	bool Resumed() const;
+
+	size_t GetIteration() const;
+	long double GetMinLambda() const;
+	long double GetMaxLambda() const;
+	bool GetNewton() const;
+	bool HasSolver(long double lambda) const;
+
+	void SetBracket(size_t iteration, long double min_lambda, long double max_lambda, bool newton = true);
+
+	// both Save overloads write at most once per CHECKPOINT_PERIOD seconds
+	void Save();
+
+	template <class T>
+	void Save(long double lambda, const Solver<T>& solver) {
+		if (!Due()) {
+			return;
+		}
+		lambda_ = lambda;
+		has_solver_ = true;
+		std::ofstream out = Open();
+		solver.Save(out);
+		Commit(out);
+	}
+
+	template <class T>
+	Solver<T> LoadSolver() const {
+		std::ifstream in(path_, std::ios::binary);
+		in.seekg(sizeof(CheckpointHeader));
+		return Solver<T>(in);
+	}
+
+	void Remove();
+};
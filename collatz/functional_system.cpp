@@ -1,13 +1,5 @@
 #include "functional_system.h"
 
-#ifndef MU
-#define MU 0
-#endif
-
-#ifndef ALPHA
-#define ALPHA std::log2(3)
-#endif
-
 
 FunctionalEquation::FunctionalEquation(size_t m, size_t k) : current_m(m), current_k(k) {
 	if (m % 3 != 2) {
@@ -46,24 +38,82 @@ void FunctionalEquation::MuTruncation() {
 	}
 }
 
-Equation<long double> FunctionalEquation::Generate(long double lambda) const {
+void FunctionalEquation::Emit(RowSink& sink) const {
 	size_t current_pow = static_cast<size_t>(std::pow(3, current_k));
 	size_t current_index = ((current_pow / 3) - 1) / 2 + (current_m - 2) / 3;
 
-	std::vector<long double> coefitients = std::vector<long double>((current_pow - 1) / 2);
-	coefitients[current_index] = 1;
+	sink.AddRow(EquationType::LESS_OR_EQUAL, 0);
+	sink.AddCoefitient(current_index, 1);
 
 	for (auto [key, alpha] : corresponding_equation_) {
 		auto [m, k] = key;
 		size_t pow = static_cast<size_t>(std::pow(3, k));
 		size_t index = ((pow / 3) - 1) / 2 + (m - 2) / 3;
-		coefitients[index] = -std::pow(lambda, -alpha);
+		sink.AddLambdaCoefitient(index, alpha);
+	}
+}
+
+// dense rows at a fixed lambda
+class EquationBuilder : public RowSink {
+private:
+	long double lambda_;
+	size_t variable_count_;
+	std::vector<Equation<long double> > equations_;
+	std::vector<long double> coefitients_;
+	EquationType type_;
+	long double result_;
+
+	void Flush() {
+		if (!coefitients_.empty()) {
+			equations_.emplace_back(coefitients_, result_, type_);
+		}
+	}
+
+public:
+	EquationBuilder(long double lambda, size_t variable_count) :
+		lambda_(lambda),
+		variable_count_(variable_count),
+		type_(EquationType::LESS_OR_EQUAL),
+		result_(0) {}
+
+	void AddRow(EquationType type, long double result) override {
+		Flush();
+		coefitients_.assign(variable_count_, 0);
+		type_ = type;
+		result_ = result;
+	}
+
+	void AddCoefitient(size_t index, long double value) override {
+		coefitients_[index] = value;
+	}
+
+	void AddLambdaCoefitient(size_t index, long double alpha) override {
+		coefitients_[index] = -std::pow(lambda_, -alpha);
+	}
+
+	std::vector<Equation<long double> > Finish() {
+		Flush();
+		coefitients_.clear();
+		return std::move(equations_);
 	}
+};
 
-	return { coefitients, 0, EquationType::LESS_OR_EQUAL };
+std::vector<LadderRow> Ladder(size_t variable_count) {
+	std::vector<LadderRow> ladder;
+	ladder.reserve(variable_count - 1);
+	for (size_t pow = 3; pow < 2 * variable_count + 1; pow *= 3) {
+		for (size_t n = 2; n < pow; n += 3) {
+			for (size_t l = 0; l < 3; ++l) {
+				size_t current_index = ((pow / 3) - 1) / 2 + (n - 2) / 3;
+				size_t next_index = (pow - 1) / 2 + (n + pow * l - 2) / 3;
+				ladder.push_back({ current_index, next_index });
+			}
+		}
+	}
+	return ladder;
 }
 
-FunctionalSystem::FunctionalSystem(size_t k) {
+FunctionalSystem::FunctionalSystem(size_t k) : k_(k) {
 	size_t pow = static_cast<size_t>(std::pow(3, k));
 	functional_system_.reserve(pow / 3);
 	for (size_t m = 2; m < pow; m += 3) {
@@ -72,28 +122,74 @@ FunctionalSystem::FunctionalSystem(size_t k) {
 	variable_count_ = (pow - 1) / 2;
 }
 
-std::vector<Equation<long double> > FunctionalSystem::Generate(long double lambda) const {
-	std::vector<Equation<long double> > generated_system;
-	generated_system.reserve(functional_system_.size());
+size_t FunctionalSystem::GetK() const {
+	return k_;
+}
+
+size_t FunctionalSystem::VariableCount() const {
+	return variable_count_;
+}
+
+void FunctionalSystem::EmitCore(RowSink& sink) const {
 	for (auto functional_equation : functional_system_) {
 		functional_equation.MuTruncation();
-		generated_system.push_back(functional_equation.Generate(lambda));
+		functional_equation.Emit(sink);
 	}
 
-	generated_system.emplace_back(std::vector<long double>{ 1 }, 1, EquationType::LESS_OR_EQUAL);
+	sink.AddRow(EquationType::LESS_OR_EQUAL, 1);
+	sink.AddCoefitient(0, 1);
+}
 
-	for (size_t pow = 3; pow < 2 * variable_count_ + 1; pow *= 3) {
-		for (size_t n = 2; n < pow; n += 3) {
-			for (size_t l = 0; l < 3; ++l) {
-				size_t current_index = ((pow / 3) - 1) / 2 + (n - 2) / 3;
-				size_t next_index = (pow - 1) / 2 + (n + pow * l - 2) / 3;
-				std::vector<long double> coefitients = std::vector<long double>(variable_count_);
-				coefitients[current_index] = 1;
-				coefitients[next_index] = -1;
-				generated_system.emplace_back(coefitients, 0, EquationType::LESS_OR_EQUAL);
-			}
-		}
+void FunctionalSystem::EmitLadder(RowSink& sink) const {
+	for (auto [parent, child] : Ladder(variable_count_)) {
+		sink.AddRow(EquationType::LESS_OR_EQUAL, 0);
+		sink.AddCoefitient(parent, 1);
+		sink.AddCoefitient(child, -1);
+	}
+}
+
+void FunctionalSystem::Emit(RowSink& sink) const {
+	EmitCore(sink);
+	EmitLadder(sink);
+}
+
+void FunctionalSystem::EmitMargin(RowSink& sink) const {
+	for (auto functional_equation : functional_system_) {
+		functional_equation.MuTruncation();
+		functional_equation.Emit(sink);
+		sink.AddCoefitient(variable_count_, 1);
+	}
+
+	// box bounds instead of one dense normalization row, the normal matrix of
+	// the barrier keeps the sparsity of the system
+	for (size_t i = 0; i < variable_count_; ++i) {
+		sink.AddRow(EquationType::LESS_OR_EQUAL, 1);
+		sink.AddCoefitient(i, 1);
 	}
 
-	return generated_system;
-}
\ No newline at end of file
+	EmitLadder(sink);
+}
+
+std::vector<Equation<long double> > FunctionalSystem::Generate(long double lambda) const {
+	EquationBuilder builder(lambda, variable_count_);
+	Emit(builder);
+	return builder.Finish();
+}
+
+std::vector<Equation<long double> > FunctionalSystem::GenerateCore(long double lambda) const {
+	EquationBuilder builder(lambda, variable_count_);
+	EmitCore(builder);
+	return builder.Finish();
+}
+
+void FunctionalSystem::Store(const std::string& path) const {
+	SystemWriter writer(path, k_, variable_count_);
+	Emit(writer);
+	writer.Finish();
+}
+
+void FunctionalSystem::StoreMargin(const std::string& path) const {
+	SystemWriter writer(path, k_, variable_count_ + 1);
+	EmitMargin(writer);
+	writer.Finish();
+}
@@ -2,13 +2,32 @@
 
 #include "linear_solver.h"
 #include "rational.h"
+#include "system_file.h"
+#include <cmath>
 #include <map>
 
+#ifndef MU
+#define MU 0
+#endif
+
+#ifndef ALPHA
+#define ALPHA std::log2(3)
+#endif
+
 class IncorectEquation : std::logic_error {
 public:
 	IncorectEquation() : std::logic_error("IncorectEquation") {}
 };
 
+// x_parent - x_child <= 0 for a residue mod 3^j and each of its three lifts
+// mod 3^(j+1), one row per variable except x0, in the order of Generate
+struct LadderRow {
+	size_t parent;
+	size_t child;
+};
+
+std::vector<LadderRow> Ladder(size_t variable_count);
+
 struct FunctionalEquation {
 private:
 	size_t current_m;
@@ -23,19 +42,38 @@ public:
 
 	void MuTruncation();
 
-	Equation<long double> Generate(long double lambda) const;
+	// the row x_m - sum lambda^-alpha x_j <= 0, the only place the Q-equations
+	// are turned into coefitients (SmallSystemLayout is checked against it)
+	void Emit(RowSink& sink) const;
 };
 
 struct FunctionalSystem {
 private:
 	std::vector<FunctionalEquation> functional_system_;
 	size_t variable_count_;
+	size_t k_;
+
+	void EmitCore(RowSink& sink) const;
+	void EmitLadder(RowSink& sink) const;
 public:
 	FunctionalSystem() = default;
 	FunctionalSystem(size_t k);
 
+	size_t GetK() const;
+	size_t VariableCount() const;
+
 	FunctionalEquation GetEquation(size_t m, size_t k) const;
 	void SetEquation(size_t m, size_t k, FunctionalEquation alpha);
 
+	// Q-equations, the normalization row and the ladder; Generate, Store and the
+	// cache check all read the rows from here
+	void Emit(RowSink& sink) const;
+	// margin system of margin.h, the margin t is the extra variable VariableCount()
+	void EmitMargin(RowSink& sink) const;
+
 	std::vector<Equation<long double> > Generate(long double lambda) const;
+	// Q-equations and the normalization row, without the ladder
+	std::vector<Equation<long double> > GenerateCore(long double lambda) const;
+	void Store(const std::string& path) const;
+	void StoreMargin(const std::string& path) const;
 };
\ No newline at end of file
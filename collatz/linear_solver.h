@@ -1,7 +1,10 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <functional>
 #include <iostream>
 #include <stdexcept>
 
@@ -15,6 +18,29 @@
 #define THRESHOLD 0
 #endif
 
+// THRESHOLD only decides whether the maximum is positive, the simplex itself uses
+//   PIVOT_TOLERANCE  - smallest tableau entry accepted as a pivot
+//   PRIMAL_TOLERANCE - infeasibility of a basic variable allowed by the ratio test
+//   DUAL_TOLERANCE   - largest contribution treated as zero at the optimum
+#ifndef PIVOT_TOLERANCE
+#define PIVOT_TOLERANCE 1e-9L
+#endif
+
+#ifndef PRIMAL_TOLERANCE
+#define PRIMAL_TOLERANCE 1e-9L
+#endif
+
+#ifndef DUAL_TOLERANCE
+#define DUAL_TOLERANCE 1e-9L
+#endif
+
+// geometric mean passes of Solver::Equilibrate, 0 leaves only the row normalization.
+// The Collatz systems are already scaled (coefitients within [lambda^-2, 1]) and
+// column scaling only changes the pivot order, so it is off by default.
+#ifndef SCALING_PASSES
+#define SCALING_PASSES 0
+#endif
+
 class InvalidOperation : std::logic_error {
 public:
 	InvalidOperation() : std::logic_error("InvalidOperation") {}
@@ -105,6 +131,23 @@ public:
 		return type_ == EquationType::GREATER || type_ == EquationType::GREATER_OR_EQUAL;
 	}
 
+	void Save(std::ostream& out) const {
+		size_t size = coefitients_.size();
+		out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		out.write(reinterpret_cast<const char*>(coefitients_.data()), size * sizeof(T));
+		out.write(reinterpret_cast<const char*>(&result_), sizeof(result_));
+		out.write(reinterpret_cast<const char*>(&type_), sizeof(type_));
+	}
+
+	void Load(std::istream& in) {
+		size_t size = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		coefitients_.resize(size);
+		in.read(reinterpret_cast<char*>(coefitients_.data()), size * sizeof(T));
+		in.read(reinterpret_cast<char*>(&result_), sizeof(result_));
+		in.read(reinterpret_cast<char*>(&type_), sizeof(type_));
+	}
+
 	void Clear() {
 		for (auto& coefitient : coefitients_) {
 			coefitient = 0;
@@ -237,20 +280,189 @@ public:
 	SystemUnbounded() : std::logic_error("SystemUnbounded") {}
 };
 
+class SystemInfeasible : std::logic_error {
+public:
+	SystemInfeasible() : std::logic_error("SystemInfeasible") {}
+};
+
 template <class T>
 class Solver {
 private:
 	std::vector<Equation<T> > system_;
 	Equation<T> max_equation_;
+	Equation<T> contribution_;
 	std::vector<T> basis_;
+	std::vector<size_t> basic_columns_;
+	std::vector<T> col_scale_;
 	size_t variable_count;
 	size_t pseudo_variable_count;
 
+	std::function<void(const Solver&)> checkpoint_;
+
+	// geometric mean scaling of the rows and of the original columns, the last
+	// pass normalizes every row to the largest coefitient 1. Scaling a column by
+	// f replaces x by f*x, so the maximum itself does not change.
+	void Equilibrate() {
+		for (size_t pass = 0; pass <= SCALING_PASSES; ++pass) {
+			for (auto& equation : system_) {
+				T min = 0;
+				T max = 0;
+				for (auto coefitient : equation.GetCoefitients()) {
+					T value = std::abs(coefitient);
+					if (value == 0) {
+						continue;
+					}
+					if (max == 0 || value < min) {
+						min = value;
+					}
+					if (value > max) {
+						max = value;
+					}
+				}
+				if (max == 0) {
+					continue;
+				}
+				T factor = pass == SCALING_PASSES ? max : std::sqrt(min * max);
+				for (auto& coefitient : equation.GetCoefitients()) {
+					coefitient /= factor;
+				}
+				equation.GetResult() /= factor;
+			}
+			if (pass == SCALING_PASSES) {
+				break;
+			}
+
+			std::vector<T> col_min(variable_count, 0);
+			std::vector<T> col_max(variable_count, 0);
+			for (const auto& equation : system_) {
+				const std::vector<T>& coefitients = equation.GetCoefitients();
+				for (size_t col = 0; col < coefitients.size(); ++col) {
+					T value = std::abs(coefitients[col]);
+					if (value == 0) {
+						continue;
+					}
+					if (col_max[col] == 0 || value < col_min[col]) {
+						col_min[col] = value;
+					}
+					if (value > col_max[col]) {
+						col_max[col] = value;
+					}
+				}
+			}
+			for (size_t col = 0; col < variable_count; ++col) {
+				if (col_max[col] == 0) {
+					continue;
+				}
+				T factor = std::sqrt(col_min[col] * col_max[col]);
+				col_scale_[col] *= factor;
+				for (auto& equation : system_) {
+					if (col < equation.VariableCount()) {
+						equation.GetCoefitients()[col] /= factor;
+					}
+				}
+				if (col < max_equation_.VariableCount()) {
+					max_equation_.GetCoefitients()[col] /= factor;
+				}
+			}
+		}
+	}
+
+	// Harris two pass ratio test. The first pass finds the longest step that keeps
+	// every basic variable above -PRIMAL_TOLERANCE, the second one takes the largest
+	// pivot among the rows whose ratio fits into that step.
+	// the chosen row may be infeasible within PRIMAL_TOLERANCE, it is clamped
+	// so the step never goes backwards
+	bool FindPivotRow(size_t pivot_col, size_t& pivot_row) {
+		bool find_bound = false;
+		T bound = 0;
+		for (size_t row = 0; row < system_.size(); ++row) {
+			T pivot = system_[row].GetCoefitients()[pivot_col];
+			if (pivot <= PIVOT_TOLERANCE) {
+				continue;
+			}
+			T ratio = (system_[row].GetResult() + PRIMAL_TOLERANCE) / pivot;
+			if (!find_bound || ratio < bound) {
+				bound = ratio;
+				find_bound = true;
+			}
+		}
+		if (!find_bound) {
+			return false;
+		}
+
+		T max_pivot = 0;
+		for (size_t row = 0; row < system_.size(); ++row) {
+			T pivot = system_[row].GetCoefitients()[pivot_col];
+			if (pivot <= PIVOT_TOLERANCE || system_[row].GetResult() / pivot > bound) {
+				continue;
+			}
+			if (pivot > max_pivot) {
+				max_pivot = pivot;
+				pivot_row = row;
+			}
+		}
+		if (system_[pivot_row].GetResult() < 0) {
+			system_[pivot_row].GetResult() = 0;
+		}
+		return true;
+	}
+
+	// dual Harris ratio test for a row with negative result: the first pass finds
+	// the longest dual step that keeps every contribution below DUAL_TOLERANCE,
+	// the second one takes the largest pivot among the columns inside it
+	bool FindDualPivotCol(size_t pivot_row, size_t& pivot_col) const {
+		const std::vector<T>& coefitients = system_[pivot_row].GetCoefitients();
+		const std::vector<T>& contribution = contribution_.GetCoefitients();
+		bool find_bound = false;
+		T bound = 0;
+		for (size_t col = 0; col < coefitients.size(); ++col) {
+			if (coefitients[col] >= -PIVOT_TOLERANCE) {
+				continue;
+			}
+			T ratio = (contribution[col] - DUAL_TOLERANCE) / coefitients[col];
+			if (!find_bound || ratio < bound) {
+				bound = ratio;
+				find_bound = true;
+			}
+		}
+		if (!find_bound) {
+			return false;
+		}
+
+		T max_pivot = 0;
+		for (size_t col = 0; col < coefitients.size(); ++col) {
+			T pivot = -coefitients[col];
+			if (pivot <= PIVOT_TOLERANCE || contribution[col] / coefitients[col] > bound) {
+				continue;
+			}
+			if (pivot > max_pivot) {
+				max_pivot = pivot;
+				pivot_col = col;
+			}
+		}
+		return true;
+	}
+
+	void Rotate(size_t pivot_row, size_t pivot_col) {
+		basis_[pivot_row] = max_equation_.GetCoefitients()[pivot_col];
+		basic_columns_[pivot_row] = pivot_col;
+		system_[pivot_row] /= system_[pivot_row].GetCoefitients()[pivot_col];
+		for (size_t row = 0; row < system_.size(); ++row) {
+			if (row == pivot_row || system_[row].GetCoefitients()[pivot_col] == 0) {
+				continue;
+			}
+			system_[row] -= system_[pivot_row] * system_[row].GetCoefitients()[pivot_col];
+		}
+
+		contribution_ -= system_[pivot_row] * contribution_.GetCoefitients()[pivot_col];
+	}
+
 public:
 	Solver(const std::vector<Equation<T> >& equations, const Equation<T>& max_equation) : 
 		system_(equations),
 		max_equation_(max_equation),
 		basis_(equations.size(), 0),
+		basic_columns_(equations.size(), 0),
 		variable_count(max_equation.VariableCount()),
 		pseudo_variable_count(0)
 	{
@@ -264,6 +476,8 @@ public:
 			++pseudo_variable_count;
 		}
 
+		col_scale_.assign(variable_count, 1);
+		Equilibrate();
 		max_equation_.GetCoefitients().resize(variable_count + pseudo_variable_count);
 
 		for (size_t i = 0, j = 0; i < system_.size(); ++i) {
@@ -275,80 +489,208 @@ public:
 				max_equation_.GetCoefitients()[variable_count + j] = -M;
 				basis_[i] = -M;
 			}
+			basic_columns_[i] = variable_count + j;
 			system_[i].GetCoefitients()[variable_count + j++] = 1;
 			system_[i].GetType() = EquationType::EQUAL;
 		}
+
+		contribution_ = max_equation_;
+	}
+
+	// restores a solver written by Save, GetMaxim continues from the saved pivot
+	Solver(std::istream& in) {
+		size_t size = 0;
+		in.read(reinterpret_cast<char*>(&variable_count), sizeof(variable_count));
+		in.read(reinterpret_cast<char*>(&pseudo_variable_count), sizeof(pseudo_variable_count));
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		system_.resize(size);
+		for (auto& equation : system_) {
+			equation.Load(in);
+		}
+		basis_.resize(size);
+		in.read(reinterpret_cast<char*>(basis_.data()), size * sizeof(T));
+		basic_columns_.resize(size);
+		in.read(reinterpret_cast<char*>(basic_columns_.data()), size * sizeof(size_t));
+		col_scale_.resize(variable_count);
+		in.read(reinterpret_cast<char*>(col_scale_.data()), variable_count * sizeof(T));
+		max_equation_.Load(in);
+		contribution_.Load(in);
+		if (!in) {
+			throw InvalidOperation{};
+		}
+	}
+
+	void Save(std::ostream& out) const {
+		size_t size = system_.size();
+		out.write(reinterpret_cast<const char*>(&variable_count), sizeof(variable_count));
+		out.write(reinterpret_cast<const char*>(&pseudo_variable_count), sizeof(pseudo_variable_count));
+		out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		for (const auto& equation : system_) {
+			equation.Save(out);
+		}
+		out.write(reinterpret_cast<const char*>(basis_.data()), size * sizeof(T));
+		out.write(reinterpret_cast<const char*>(basic_columns_.data()), size * sizeof(size_t));
+		out.write(reinterpret_cast<const char*>(col_scale_.data()), variable_count * sizeof(T));
+		max_equation_.Save(out);
+		contribution_.Save(out);
+	}
+
+	// crossover: pivots the given columns into the basis before GetMaxim, columns
+	// without an admissible pivot row are skipped
+	void WarmStart(const std::vector<size_t>& columns) {
+		for (size_t col : columns) {
+			size_t pivot_row = 0;
+			if (col < contribution_.VariableCount() && FindPivotRow(col, pivot_row)) {
+				Rotate(pivot_row, col);
+			}
+		}
+	}
+
+	// adds a <= row to an optimal solver without rebuilding it: the row gets its
+	// own slack, is expressed through the current basis and a violated row is
+	// repaired by dual simplex pivots in the next GetMaxim
+	void AddEquation(const Equation<T>& equation) {
+		if (!equation.IsLessInequality() || !IsOptimal()) {
+			throw InvalidOperation{};
+		}
+
+		size_t slack = contribution_.VariableCount();
+		Equation<T> row = equation;
+		row.GetCoefitients().resize(variable_count, 0);
+		T max = 0;
+		for (size_t col = 0; col < variable_count; ++col) {
+			row.GetCoefitients()[col] /= col_scale_[col];
+			max = std::max(max, std::abs(row.GetCoefitients()[col]));
+		}
+		if (max != 0) {
+			for (auto& coefitient : row.GetCoefitients()) {
+				coefitient /= max;
+			}
+			row.GetResult() /= max;
+		}
+		row.GetCoefitients().resize(slack + 1, 0);
+		row.GetCoefitients()[slack] = 1;
+		row.GetType() = EquationType::EQUAL;
+
+		for (auto& current : system_) {
+			current.GetCoefitients().push_back(0);
+		}
+		max_equation_.GetCoefitients().push_back(0);
+		contribution_.GetCoefitients().push_back(0);
+
+		for (size_t i = 0; i < system_.size(); ++i) {
+			T factor = row.GetCoefitients()[basic_columns_[i]];
+			if (factor != 0) {
+				row -= system_[i] * factor;
+			}
+		}
+
+		system_.push_back(row);
+		basis_.push_back(0);
+		basic_columns_.push_back(slack);
+		++pseudo_variable_count;
 	}
 
-	T GetMaxim() {
-		Equation<T> contribution = max_equation_;
+	bool IsOptimal() const {
+		for (auto coefitient : contribution_.GetCoefitients()) {
+			if (coefitient > DUAL_TOLERANCE) {
+				return false;
+			}
+		}
+		return true;
+	}
 
+	// values of the original variables in the current basis
+	std::vector<T> GetSolution() const {
+		std::vector<T> solution(variable_count, 0);
+		for (size_t row = 0; row < system_.size(); ++row) {
+			if (basic_columns_[row] < variable_count) {
+				solution[basic_columns_[row]] = system_[row].GetResult() / col_scale_[basic_columns_[row]];
+			}
+		}
+		return solution;
+	}
+
+	// checkpoint is called after every pivot, it decides itself when to write
+	void SetCheckpoint(std::function<void(const Solver&)> checkpoint) {
+		checkpoint_ = checkpoint;
+	}
+
+	// with early_stop the search ends as soon as the maximum is known to exceed
+	// THRESHOLD, the basis is then feasible but not necessarily optimal
+	T GetMaxim(bool early_stop = true) {
 		while (true) {
+			// DUAL SIMPLEX (rows added by AddEquation)
+			size_t leaving_row = system_.size();
+			for (size_t row = 0; row < system_.size(); ++row) {
+				if (system_[row].GetResult() < -PRIMAL_TOLERANCE && (leaving_row == system_.size() ||
+					system_[row].GetResult() < system_[leaving_row].GetResult())) {
+					leaving_row = row;
+				}
+			}
+			// only from a dual feasible basis, otherwise a drift below -PRIMAL_TOLERANCE
+			// is left to the primal pivots
+			if (leaving_row != system_.size() && IsOptimal()) {
+				// the dual objective only decreases, so it already bounds the maximum
+				if (-contribution_.GetResult() <= THRESHOLD) {
+					return -contribution_.GetResult();
+				}
+				size_t entering_col = 0;
+				if (!FindDualPivotCol(leaving_row, entering_col)) {
+					throw SystemInfeasible{};
+				}
+				Rotate(leaving_row, entering_col);
+				if (checkpoint_) {
+					checkpoint_(*this);
+				}
+				continue;
+			}
+
 			// PIVOT COL SELECTION
 			size_t pivot_col = 0;
-			for (size_t col = 0; col < contribution.VariableCount(); ++col) {
-				if (contribution.GetCoefitients()[col] >
-					contribution.GetCoefitients()[pivot_col]) {
+			for (size_t col = 0; col < contribution_.VariableCount(); ++col) {
+				if (contribution_.GetCoefitients()[col] >
+					contribution_.GetCoefitients()[pivot_col]) {
 					pivot_col = col;
 				}
 			}
-			T value = contribution.GetCoefitients()[pivot_col];
-			if (contribution.GetCoefitients()[pivot_col] <= THRESHOLD) {
-				return -contribution.GetResult();
+			if (contribution_.GetCoefitients()[pivot_col] <= DUAL_TOLERANCE) {
+				return -contribution_.GetResult();
 			}
 
 			// PIVOT ROW SELECTION
 			size_t pivot_row = 0;
-			bool find_minimum = false;
-			for (size_t row = 0; row < system_.size(); ++row) {
-				if (system_[row].GetCoefitients()[pivot_col] <= THRESHOLD) {
-					continue;
-				}
-				if (!find_minimum ||
-					system_[row].GetResult() / system_[row].GetCoefitients()[pivot_col] <
-					system_[pivot_row].GetResult() / system_[pivot_row].GetCoefitients()[pivot_col] || (
-						system_[row].GetResult() <= THRESHOLD &&
-						system_[row].GetCoefitients()[pivot_col] > system_[pivot_row].GetCoefitients()[pivot_col])) {
-					pivot_row = row;
-					find_minimum = true;
-				}
-			}
-			if (!find_minimum) {
-
+			if (!FindPivotRow(pivot_col, pivot_row)) {
+#ifdef DEBUG
 				std::cout << "\n\nERROR\n\nbasis: { ";
 				for (auto var : basis_) {
 					std::cout << var << " ";
 				}
-				std::cout << "}\ncontibution :\n" << contribution << std::endl;
+				std::cout << "}\ncontibution :\n" << contribution_ << std::endl;
 				std::cout << "max_equation :\n" << max_equation_ << "\nsystem:\n";
 				Log();
 				std::cout << "pivot_col = " << pivot_col << std::endl;
 				std::cout << "pivot_row = " << pivot_row << std::endl;
-
+#endif // DEBUG
 				throw SystemUnbounded{};
 			}
 
 			// PIVOT ROTATION
-			basis_[pivot_row] = max_equation_.GetCoefitients()[pivot_col];
-			system_[pivot_row] /= system_[pivot_row].GetCoefitients()[pivot_col];
-			for (size_t row = 0; row < system_.size(); ++row) {
-				if (row == pivot_row) {
-					continue;
-				}
-				system_[row] -= system_[pivot_row] * system_[row].GetCoefitients()[pivot_col];
-			}
-			
-			contribution -= system_[pivot_row] * contribution.GetCoefitients()[pivot_col];
-			if (contribution.GetResult() < -THRESHOLD) {
+			Rotate(pivot_row, pivot_col);
+			if (early_stop && contribution_.GetResult() < -THRESHOLD) {
 				return 1;
 			}
 
+			if (checkpoint_) {
+				checkpoint_(*this);
+			}
+
 #ifdef DEBUG
 			std::cout << "basis: { ";
 			for (auto var : basis_) {
 				std::cout << var << " ";
 			}
-			std::cout << "}\ncontibution :\n" << contribution << std::endl;
+			std::cout << "}\ncontibution :\n" << contribution_ << std::endl;
 			std::cout << "max_equation :\n" << max_equation_ << "\nsystem:\n";
 			Log();
 			std::cout << "pivot_col = " << pivot_col << std::endl;
@@ -1,17 +1,127 @@
 //#define DEBUG
 #define THRESHOLD 0.000001L
 #define PRESIDION 20
+#define SYSTEM_CACHE "system_k"
+#define CHECKPOINT "checkpoint_k"
+#define BARRIER_K 6
+// debugging aid only: a dense simplex from the barrier basis, k=6 takes 30 s instead of 0.3 s
+//#define CROSSOVER
+#define LAZY_LADDER
+#define NEWTON
+#define NEWTON_K 4
+#define MARGIN_CACHE "margin_k"
 #include "linear_solver.h"
 
+#include "barrier_solver.h"
+#include "batch_solver.h"
+#include "checkpoint.h"
 #include "functional_system.h"
+#include "margin.h"
+#include "small_system.h"
+#include "system_file.h"
 #include <cmath>
+#include <iomanip>
+#include <optional>
 #include <stdio.h>
+// std::min and std::max below, windows.h defines them as macros otherwise
+#define NOMINMAX
 #include <windows.h>
 
 //#include "rational.h"
 
-bool L(long double lambda, const FunctionalSystem& j_system) {
-	Solver<long double> solver { j_system.Generate(lambda), {{1}} };
+// the mapped system is read by BarrierSolver directly, without the dense Generate
+template <class System>
+BarrierSolver<long double> MakeBarrier(long double lambda, const System& j_system) {
+	if constexpr (std::is_same_v<System, MappedSystem>) {
+		return { j_system, lambda, {{1}} };
+	} else {
+		return { j_system.Generate(lambda), {{1}} };
+	}
+}
+
+template <class System>
+bool LBarrier(long double lambda, const System& j_system) {
+	BarrierSolver<long double> barrier = MakeBarrier(lambda, j_system);
+	long double maximum = barrier.GetMaxim();
+
+#ifdef CROSSOVER
+	Solver<long double> solver{ j_system.Generate(lambda), {{1}} };
+	solver.WarmStart(barrier.GetBasis());
+	maximum = solver.GetMaxim();
+#endif
+
+	return maximum > THRESHOLD;
+}
+
+// cutting plane loop: the solver starts without the ladder and gets only the
+// ladder rows violated by its current solution
+bool CutLadder(Solver<long double>& solver, size_t variable_count) {
+	std::vector<LadderRow> ladder = Ladder(variable_count);
+	long double maximum = solver.GetMaxim();
+	while (maximum > THRESHOLD) {
+		std::vector<long double> solution = solver.GetSolution();
+		std::vector<LadderRow> violated;
+		for (auto row : ladder) {
+			if (solution[row.parent] - solution[row.child] > PRIMAL_TOLERANCE) {
+				violated.push_back(row);
+			}
+		}
+		if (violated.empty()) {
+			return true;
+		}
+
+		// rows are added only at the optimum of the current relaxation
+		if (!solver.IsOptimal()) {
+			maximum = solver.GetMaxim(false);
+			continue;
+		}
+		for (auto [parent, child] : violated) {
+			std::vector<long double> coefitients = std::vector<long double>(variable_count);
+			coefitients[parent] = 1;
+			coefitients[child] = -1;
+			solver.AddEquation({ coefitients, 0, EquationType::LESS_OR_EQUAL });
+		}
+		maximum = solver.GetMaxim();
+	}
+	return false;
+}
+
+template <class System>
+bool L(long double lambda, const System& j_system, Checkpoint& checkpoint) {
+#ifdef BARRIER_K
+	if (j_system.GetK() >= BARRIER_K) {
+		try {
+			return LBarrier(lambda, j_system);
+		} catch (NotConverged&) {
+			// right at the critical lambda the barrier may stall, the simplex decides
+		}
+	}
+#endif
+
+#ifdef LAZY_LADDER
+	Solver<long double> solver = checkpoint.HasSolver(lambda) ?
+		checkpoint.LoadSolver<long double>() :
+		Solver<long double>{ j_system.GenerateCore(lambda), {{1}} };
+#else
+	Solver<long double> solver = checkpoint.HasSolver(lambda) ?
+		checkpoint.LoadSolver<long double>() :
+		Solver<long double>{ j_system.Generate(lambda), {{1}} };
+#endif
+	solver.SetCheckpoint([&](const Solver<long double>& current) {
+		checkpoint.Save(lambda, current);
+	});
+
+#ifdef LAZY_LADDER
+	return CutLadder(solver, j_system.VariableCount());
+#else
+	long double maximum = solver.GetMaxim();
+	return maximum > THRESHOLD;
+#endif
+}
+
+template <size_t K>
+bool L(long double lambda, const SmallSystem<K>&, Checkpoint&) {
+	SmallSolver<K> solver(lambda);
 
 	long double maximum = solver.GetMaxim();
 	return maximum > THRESHOLD;
@@ -36,25 +146,210 @@ void ProgressBar(int percent, int width) {
 	printf("\x1b[0m");
 }
 
-std::pair<long double, long double> N(const FunctionalSystem& j_system) {
+// the system of k (or its margin system of margin.h) mapped from prefix<k>.bin;
+// the file is written again when it is missing or was written from other rows,
+// e.g. with another ALPHA or MU
+MappedSystem CachedSystem(const std::string& prefix, size_t k, bool margin) {
+	std::string path = prefix + std::to_string(k) + ".bin";
+	FunctionalSystem system(k);
+	SystemHash hash;
+	if (margin) {
+		system.EmitMargin(hash);
+	} else {
+		system.Emit(hash);
+	}
+	if (!SystemFileMatches(path, hash.Value())) {
+		if (margin) {
+			system.StoreMargin(path);
+		} else {
+			system.Store(path);
+		}
+	}
+	return MappedSystem(path);
+}
+
+// the search stops at the bracket width of PRESIDION bisection steps over [1, 2];
+// with NEWTON the probes follow Newton steps on the margin from below
+template <class System>
+std::pair<long double, long double> N(const System& j_system, Checkpoint& checkpoint) {
 	long double min_lambda = 1;
 	long double max_lambda = 2;
-	for (size_t i = 0; i < PRESIDION; ++i) {
-		ProgressBar(i * 100 / PRESIDION, 20);
+	size_t probes = 0;
+	if (checkpoint.Resumed()) {
+		min_lambda = checkpoint.GetMinLambda();
+		max_lambda = checkpoint.GetMaxLambda();
+		probes = checkpoint.GetIteration();
+	}
+	const long double width = std::ldexp(1.0L, -PRESIDION);
+
+#ifdef NEWTON
+	// below NEWTON_K a margin solve costs more than the probes it saves, the
+	// search stays with bisection there
+	std::optional<MappedSystem> margin_system;
+	if (j_system.GetK() >= NEWTON_K) {
+		margin_system.emplace(CachedSystem(MARGIN_CACHE, j_system.GetK(), true));
+	}
+	size_t margin_solves = 0;
+	auto evaluate_margin = [&](long double lambda) -> Margin {
+		if (!margin_system) {
+			return { 0, 0 };
+		}
+		++margin_solves;
+		try {
+			return EvaluateMargin(*margin_system, lambda);
+		} catch (NotConverged&) {
+			return { 0, 0 };
+		}
+	};
+	Margin margin = evaluate_margin(min_lambda);
+	// a resumed search takes the same kind of step it would have taken
+	bool newton = checkpoint.GetNewton();
+#endif
+
+	while (max_lambda - min_lambda > width) {
+		ProgressBar(static_cast<int>(std::min(-std::log2(max_lambda - min_lambda) * 100 / PRESIDION, 99.0L)), 20);
 		long double lambda = (min_lambda + max_lambda) / 2;
-		if (L(lambda, j_system)) {
+#ifdef NEWTON
+		// the probe goes 0.45 of the final width before the Newton root, and after
+		// it once the root is that close, so two accurate steps close the bracket;
+		// the distance also keeps the probes off the critical lambda itself, where
+		// the LP is too ill conditioned for the barrier
+		long double previous_width = max_lambda - min_lambda;
+		long double previous_margin = margin.value;
+		if (newton && margin.value > 0 && margin.derivative < 0) {
+			long double root = min_lambda - margin.value / margin.derivative;
+			long double candidate = root - min_lambda > width / 2 ? root - 0.45L * width : root + 0.45L * width;
+			if (candidate > min_lambda && candidate < max_lambda) {
+				lambda = candidate;
+			}
+		}
+#endif
+		bool positive = L(lambda, j_system, checkpoint);
+		if (positive) {
 			min_lambda = lambda;
+#ifdef NEWTON
+			margin = evaluate_margin(min_lambda);
+#endif
 		} else {
 			max_lambda = lambda;
 		}
+#ifdef NEWTON
+		// safeguard: a probe that neither halved the margin nor the bracket is
+		// followed by bisection
+		newton = positive ? margin.value <= previous_margin / 2 : max_lambda - min_lambda <= previous_width / 2;
+#endif
+		++probes;
+#ifdef NEWTON
+		checkpoint.SetBracket(probes, min_lambda, max_lambda, newton);
+#else
+		checkpoint.SetBracket(probes, min_lambda, max_lambda);
+#endif
+		checkpoint.Save();
 	}
 	ProgressBar(100, 20);
-	printf("\nDone!\n\n");
+	printf("\nDone!\nprobes : %zu\n", probes);
+#ifdef NEWTON
+	printf("margin solves : %zu\n", margin_solves);
+#endif
+	printf("\n");
 	return { min_lambda, max_lambda };
 }
 
-void Evaluate() {
-	std::cout << std::fixed;
+// k <= SMALL_K goes to the compile time specialized SmallSystem<k>
+template <size_t K = SMALL_K>
+std::pair<long double, long double> DispatchN(size_t k, Checkpoint& checkpoint) {
+	if constexpr (K >= 2) {
+		if (k == K) {
+			return N(SmallSystem<K>{}, checkpoint);
+		}
+		return DispatchN<K - 1>(k, checkpoint);
+	} else {
+#ifdef SYSTEM_CACHE
+		return N(CachedSystem(SYSTEM_CACHE, k, false), checkpoint);
+#else
+		return N(FunctionalSystem(k), checkpoint);
+#endif
+	}
+}
+
+// L at every lambda of the sweep, k <= SMALL_K solves BATCH_WIDTH lambda at once
+template <size_t K = SMALL_K>
+std::vector<bool> DispatchSweep(size_t k, const std::vector<long double>& lambdas) {
+	if constexpr (K >= 2) {
+		if (k != K) {
+			return DispatchSweep<K - 1>(k, lambdas);
+		}
+		std::vector<bool> values(lambdas.size());
+		for (size_t i = 0; i < lambdas.size(); i += BATCH_WIDTH) {
+			// the last batch is filled up with its last lambda
+			std::array<long double, BATCH_WIDTH> batch;
+			for (size_t lane = 0; lane < BATCH_WIDTH; ++lane) {
+				batch[lane] = lambdas[std::min(i + lane, lambdas.size() - 1)];
+			}
+			std::array<long double, BATCH_WIDTH> maxima = BatchSolver<K>(batch).GetMaxim();
+			for (size_t lane = 0; lane < BATCH_WIDTH && i + lane < lambdas.size(); ++lane) {
+				values[i + lane] = maxima[lane] > THRESHOLD;
+			}
+		}
+		return values;
+	} else {
+#ifdef SYSTEM_CACHE
+		MappedSystem system = CachedSystem(SYSTEM_CACHE, k, false);
+#else
+		FunctionalSystem system(k);
+#endif
+		// a sweep is not resumed, its checkpoint is never written
+		Checkpoint checkpoint;
+		std::vector<bool> values(lambdas.size());
+		for (size_t i = 0; i < lambdas.size(); ++i) {
+			values[i] = L(lambdas[i], system, checkpoint);
+		}
+		return values;
+	}
+}
+
+// L on count equally spaced points of [min_lambda, max_lambda]
+void Sweep() {
+	while (true) {
+		int k;
+		long double min_lambda, max_lambda;
+		size_t count;
+		std::cout << "enter value of k : ";
+		std::cin >> k;
+		std::cout << "enter lambda range and count : ";
+		std::cin >> min_lambda >> max_lambda >> count;
+
+		std::vector<long double> lambdas(count);
+		for (size_t i = 0; i < count; ++i) {
+			lambdas[i] = count > 1 ? min_lambda + (max_lambda - min_lambda) * i / (count - 1) : min_lambda;
+		}
+
+		clock_t start = clock();
+		std::vector<bool> values = DispatchSweep(k, lambdas);
+		clock_t end = clock();
+
+		for (size_t i = 0; i < count; ++i) {
+			printf("%.10Lf : %d\n", lambdas[i], static_cast<int>(values[i]));
+		}
+		long double duration = static_cast<long double>(end - start) / CLOCKS_PER_SEC;
+		std::cout << "evaluation time : " << duration << "\n\n\n";
+		std::cout.flush();
+	}
+}
+
+// with resume a run continues from CHECKPOINT<k>.bin left by an interrupted run
+// the build options that change the tableau a checkpoint holds
+uint64_t SolverMode() {
+	uint64_t mode = SCALING_PASSES;
+#ifdef LAZY_LADDER
+	mode |= 1ull << 32;
+#endif
+	return mode;
+}
+
+void Evaluate(bool resume) {
+	// the bracket no longer lies on the bisection grid, 7 digits keep its ends apart
+	std::cout << std::fixed << std::setprecision(7);
 	while (true) {
 		int k;
 		std::cout << "enter value of k : ";
@@ -64,7 +359,15 @@ void Evaluate() {
 
 		start = clock();
 
-		auto [min_lambda, max_lambda] = N(FunctionalSystem(k));
+		SystemHash hash;
+		FunctionalSystem(k).Emit(hash);
+		Checkpoint checkpoint(CHECKPOINT + std::to_string(k) + ".bin", k, hash.Value(), SolverMode());
+		if (resume && !checkpoint.Load()) {
+			std::cout << "no checkpoint for this system, starting over\n";
+		}
+
+		auto [min_lambda, max_lambda] = DispatchN(k, checkpoint);
+		checkpoint.Remove();
 		long double min_gamma = std::log2(min_lambda);
 		long double max_gamma = std::log2(max_lambda);
 
@@ -80,12 +383,19 @@ void Evaluate() {
 	}
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
 	DWORD consoleMode;
 	GetConsoleMode(console, &consoleMode);
 	consoleMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
 	SetConsoleMode(console, consoleMode);
 
-	Evaluate();
+	CheckSmallSystem();
+
+	if (argc > 1 && std::string(argv[1]) == "--sweep") {
+		Sweep();
+	} else {
+		bool resume = argc > 1 && std::string(argv[1]) == "--resume";
+		Evaluate(resume);
+	}
 }
\ No newline at end of file
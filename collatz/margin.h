@@ -0,0 +1,42 @@
+#pragma once
+
+#include "barrier_solver.h"
+#include "system_file.h"
+#include <cmath>
+
+// Margin of the system at lambda:
+//   max t  s.t.  Q(lambda) x + t <= 0,  ladder,  0 <= x_i <= 1,  t >= 0
+// (written by FunctionalSystem::StoreMargin, t is the last variable).
+// A positive margin is a strictly feasible point of the original system, so
+// L(lambda) holds. The margin decreases smoothly to 0 at the critical lambda
+// and stays 0 above it, which makes it usable for Newton steps from below.
+
+struct Margin {
+	long double value;
+	long double derivative;
+};
+
+// the derivative comes from the duals: d max / d lambda = -y^T (dA / dlambda) x,
+// where only the lambda coefitients -lambda^-alpha depend on lambda
+inline Margin EvaluateMargin(const MappedSystem& system, long double lambda) {
+	std::vector<long double> objective = std::vector<long double>(system.VariableCount());
+	objective.back() = 1;
+	BarrierSolver<long double> barrier(system, lambda, { objective });
+
+	Margin margin{ barrier.GetMaxim(), 0 };
+	std::vector<long double> solution = barrier.GetSolution();
+	std::vector<long double> duals = barrier.GetDuals();
+
+	const SystemEntry* entries = system.Entries();
+	const uint64_t* row_offsets = system.RowOffsets();
+	for (size_t row = 0; row < system.RowCount(); ++row) {
+		for (uint64_t i = row_offsets[row]; i < row_offsets[row + 1]; ++i) {
+			if (entries[i].slot < 0) {
+				continue;
+			}
+			long double alpha = system.Alphas()[entries[i].slot];
+			margin.derivative -= duals[row] * alpha * std::pow(lambda, -alpha - 1) * solution[entries[i].column];
+		}
+	}
+	return margin;
+}
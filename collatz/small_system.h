@@ -0,0 +1,273 @@
+#pragma once
+
+#include "functional_system.h"
+#include <array>
+#include <cmath>
+#include <vector>
+
+// Stack resident variant of FunctionalSystem(K) + Solver for small K.
+// The index layout and the constraint pattern are built at compile time,
+// only the three lambda dependent coefitients are evaluated per call.
+
+#ifndef SMALL_K
+#define SMALL_K 5
+#endif
+
+// SmallSolver is a local variable of L, its tableau has to fit the stack
+// (1 MB by default with MSVC) next to everything else; K = 5 takes about 390 KB
+// with an 80 bit long double, K = 6 about 1.8 MB even with a 64 bit one
+#ifndef SMALL_STACK_LIMIT
+#define SMALL_STACK_LIMIT (512 * 1024)
+#endif
+
+constexpr size_t Pow3(size_t k) {
+	size_t pow = 1;
+	for (size_t i = 0; i < k; ++i) {
+		pow *= 3;
+	}
+	return pow;
+}
+
+constexpr size_t VariableIndex(size_t m, size_t k) {
+	return ((Pow3(k) / 3) - 1) / 2 + (m - 2) / 3;
+}
+
+struct SmallEntry {
+	size_t column = 0;
+	int slot = -1;      // -1 for a constant coefitient, otherwise index into alphas
+	long double value = 0;
+};
+
+template <size_t K>
+struct SmallSystemLayout {
+	static constexpr size_t POW = Pow3(K);
+	static constexpr size_t VARIABLE_COUNT = (POW - 1) / 2;
+	static constexpr size_t EQUATION_COUNT = POW / 3;
+	static constexpr size_t ROW_COUNT = EQUATION_COUNT + 1 + (POW - 3) / 2;
+	static constexpr size_t ROW_WIDTH = 3;
+
+	std::array<std::array<SmallEntry, ROW_WIDTH>, ROW_COUNT> entries{};
+	std::array<size_t, ROW_COUNT> sizes{};
+	std::array<long double, ROW_COUNT> results{};
+
+	constexpr SmallSystemLayout() {
+		size_t row = 0;
+		for (size_t m = 2; m < POW; m += 3, ++row) {
+			entries[row][sizes[row]++] = { VariableIndex(m, K), -1, 1 };
+			entries[row][sizes[row]++] = { VariableIndex((4 * m) % POW, K), 0, 0 };      // alpha = 2
+			if (m % 9 == 2) {
+				entries[row][sizes[row]++] = { VariableIndex(((4 * m - 2) / 3) % (POW / 3), K - 1), 1, 0 };  // alpha = 2 - ALPHA
+			} else if (m % 9 == 8) {
+				entries[row][sizes[row]++] = { VariableIndex(((2 * m - 1) / 3) % (POW / 3), K - 1), 2, 0 };  // alpha = 1 - ALPHA
+			}
+		}
+
+		entries[row][sizes[row]++] = { 0, -1, 1 };
+		results[row++] = 1;
+
+		for (size_t pow = 3; pow < POW; pow *= 3) {
+			for (size_t n = 2; n < pow; n += 3) {
+				for (size_t l = 0; l < 3; ++l, ++row) {
+					entries[row][sizes[row]++] = { ((pow / 3) - 1) / 2 + (n - 2) / 3, -1, 1 };
+					entries[row][sizes[row]++] = { (pow - 1) / 2 + (n + pow * l - 2) / 3, -1, -1 };
+				}
+			}
+		}
+	}
+};
+
+template <size_t K>
+struct SmallSystem {
+	static constexpr SmallSystemLayout<K> layout{};
+
+	size_t GetK() const {
+		return K;
+	}
+};
+
+// alphas of the three slots of the layout, truncated like FunctionalEquation::MuTruncation
+inline std::array<long double, 3> SmallSlotAlphas() {
+	std::array<long double, 3> alphas = { 2, 2 - ALPHA, 1 - ALPHA };
+	for (auto& alpha : alphas) {
+		if (alpha < 0) {
+			alpha = MU;
+		}
+	}
+	return alphas;
+}
+
+class InvalidSmallSystem : std::logic_error {
+public:
+	InvalidSmallSystem() : std::logic_error("InvalidSmallSystem") {}
+};
+
+// SmallSystemLayout repeats the Q-equations of FunctionalEquation by hand, the
+// rows of every k <= K must be those of FunctionalSystem(k).Generate(lambda)
+template <size_t K = SMALL_K>
+void CheckSmallSystem(long double lambda = 1.5L) {
+	if constexpr (K >= 2) {
+		CheckSmallSystem<K - 1>(lambda);
+
+		using Layout = SmallSystemLayout<K>;
+		std::array<long double, 3> alphas = SmallSlotAlphas();
+		std::vector<Equation<long double> > generated = FunctionalSystem(K).Generate(lambda);
+		if (generated.size() != Layout::ROW_COUNT) {
+			throw InvalidSmallSystem{};
+		}
+		for (size_t row = 0; row < Layout::ROW_COUNT; ++row) {
+			std::vector<long double> coefitients(Layout::VARIABLE_COUNT);
+			for (size_t i = 0; i < SmallSystem<K>::layout.sizes[row]; ++i) {
+				const SmallEntry& entry = SmallSystem<K>::layout.entries[row][i];
+				coefitients[entry.column] = entry.slot < 0 ? entry.value : -std::pow(lambda, -alphas[entry.slot]);
+			}
+			const Equation<long double>& equation = generated[row];
+			if (equation.GetCoefitients().size() != coefitients.size() ||
+				equation.GetType() != EquationType::LESS_OR_EQUAL ||
+				equation.GetResult() != SmallSystem<K>::layout.results[row]) {
+				throw InvalidSmallSystem{};
+			}
+			for (size_t col = 0; col < coefitients.size(); ++col) {
+				if (std::abs(equation.GetCoefitients()[col] - coefitients[col]) > THRESHOLD) {
+					throw InvalidSmallSystem{};
+				}
+			}
+		}
+	}
+}
+
+template <size_t K, size_t W, class T>
+class BatchSolver;
+
+// Same pivoting rules and tolerances as Solver::GetMaxim, but the tableau only
+// keeps the nonbasic columns (the slack identity is implicit) and lives in
+// std::array. There is no equilibration, every row already has the largest
+// coefitient 1.
+template <size_t K, class T = long double>
+class SmallSolver {
+private:
+	using Layout = SmallSystemLayout<K>;
+	static constexpr size_t ROWS = Layout::ROW_COUNT;
+	static constexpr size_t COLS = Layout::VARIABLE_COUNT;
+
+	std::array<std::array<T, COLS>, ROWS> system_;
+	std::array<T, ROWS> results_;
+	std::array<T, COLS> contribution_;
+	T contribution_result_;
+	std::array<size_t, ROWS> basis_;
+	std::array<size_t, COLS> nonbasis_;
+
+	// BatchSolver fills in the tableau of a lane it splits off
+	template <size_t, size_t, class>
+	friend class BatchSolver;
+
+	SmallSolver() : contribution_result_(0) {
+		static_assert(sizeof(SmallSolver) <= SMALL_STACK_LIMIT, "SmallSolver<K> does not fit the stack, lower SMALL_K");
+	}
+
+public:
+	SmallSolver(long double lambda) : SmallSolver() {
+		std::array<long double, 3> alphas = SmallSlotAlphas();
+		std::array<T, 3> slots;
+		for (size_t slot = 0; slot < slots.size(); ++slot) {
+			slots[slot] = static_cast<T>(-std::pow(lambda, -alphas[slot]));
+		}
+
+		for (size_t row = 0; row < ROWS; ++row) {
+			system_[row].fill(0);
+			for (size_t i = 0; i < SmallSystem<K>::layout.sizes[row]; ++i) {
+				const SmallEntry& entry = SmallSystem<K>::layout.entries[row][i];
+				system_[row][entry.column] = entry.slot < 0 ? static_cast<T>(entry.value) : slots[entry.slot];
+			}
+			results_[row] = static_cast<T>(SmallSystem<K>::layout.results[row]);
+			basis_[row] = COLS + row;
+		}
+
+		contribution_.fill(0);
+		contribution_[0] = 1;
+		for (size_t col = 0; col < COLS; ++col) {
+			nonbasis_[col] = col;
+		}
+	}
+
+	T GetMaxim() {
+		while (true) {
+			// PIVOT COL SELECTION
+			size_t pivot_col = 0;
+			for (size_t col = 1; col < COLS; ++col) {
+				if (contribution_[col] > contribution_[pivot_col] ||
+					(contribution_[col] == contribution_[pivot_col] && nonbasis_[col] < nonbasis_[pivot_col])) {
+					pivot_col = col;
+				}
+			}
+			if (contribution_[pivot_col] <= DUAL_TOLERANCE) {
+				return -contribution_result_;
+			}
+
+			// PIVOT ROW SELECTION (Harris two pass ratio test)
+			bool find_bound = false;
+			T bound = 0;
+			for (size_t row = 0; row < ROWS; ++row) {
+				if (system_[row][pivot_col] <= PIVOT_TOLERANCE) {
+					continue;
+				}
+				T ratio = (results_[row] + PRIMAL_TOLERANCE) / system_[row][pivot_col];
+				if (!find_bound || ratio < bound) {
+					bound = ratio;
+					find_bound = true;
+				}
+			}
+			if (!find_bound) {
+				throw SystemUnbounded{};
+			}
+
+			size_t pivot_row = 0;
+			T max_pivot = 0;
+			for (size_t row = 0; row < ROWS; ++row) {
+				T pivot = system_[row][pivot_col];
+				if (pivot <= PIVOT_TOLERANCE || results_[row] / pivot > bound) {
+					continue;
+				}
+				if (pivot > max_pivot) {
+					max_pivot = pivot;
+					pivot_row = row;
+				}
+			}
+
+			// PIVOT ROTATION
+			if (results_[pivot_row] < 0) {
+				results_[pivot_row] = 0;
+			}
+			T pivot = system_[pivot_row][pivot_col];
+			for (size_t col = 0; col < COLS; ++col) {
+				system_[pivot_row][col] /= pivot;
+			}
+			results_[pivot_row] /= pivot;
+			system_[pivot_row][pivot_col] = 1 / pivot;
+
+			for (size_t row = 0; row < ROWS; ++row) {
+				T factor = system_[row][pivot_col];
+				if (row == pivot_row || factor == 0) {
+					continue;
+				}
+				for (size_t col = 0; col < COLS; ++col) {
+					system_[row][col] -= system_[pivot_row][col] * factor;
+				}
+				results_[row] -= results_[pivot_row] * factor;
+				system_[row][pivot_col] = -factor / pivot;
+			}
+
+			T factor = contribution_[pivot_col];
+			for (size_t col = 0; col < COLS; ++col) {
+				contribution_[col] -= system_[pivot_row][col] * factor;
+			}
+			contribution_result_ -= results_[pivot_row] * factor;
+			contribution_[pivot_col] = -factor / pivot;
+
+			std::swap(basis_[pivot_row], nonbasis_[pivot_col]);
+
+			if (contribution_result_ < -THRESHOLD) {
+				return 1;
+			}
+		}
+	}
+};
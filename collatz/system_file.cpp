@@ -0,0 +1,355 @@
+#include "system_file.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char SYSTEM_FILE_MAGIC[8] = { 'C', 'O', 'L', 'L', 'A', 'T', 'Z', 0 };
+
+SystemHash::SystemHash() : value_(14695981039346656037ull) {}
+
+void SystemHash::Add(const void* data, size_t size) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		value_ ^= bytes[i];
+		value_ *= 1099511628211ull;
+	}
+}
+
+void SystemHash::AddRow(EquationType type, long double result) {
+	uint8_t stored_type = static_cast<uint8_t>(type);
+	double stored_result = static_cast<double>(result);
+	Add("r", 1);
+	Add(&stored_type, sizeof(stored_type));
+	Add(&stored_result, sizeof(stored_result));
+}
+
+void SystemHash::AddCoefitient(size_t index, long double value) {
+	uint64_t stored_index = index;
+	double stored_value = static_cast<double>(value);
+	Add("c", 1);
+	Add(&stored_index, sizeof(stored_index));
+	Add(&stored_value, sizeof(stored_value));
+}
+
+void SystemHash::AddLambdaCoefitient(size_t index, long double alpha) {
+	uint64_t stored_index = index;
+	double stored_alpha = static_cast<double>(alpha);
+	Add("l", 1);
+	Add(&stored_index, sizeof(stored_index));
+	Add(&stored_alpha, sizeof(stored_alpha));
+}
+
+uint64_t SystemHash::Value() const {
+	return value_;
+}
+
+SystemWriter::SystemWriter(const std::string& path, size_t k, size_t variable_count) :
+	path_(path),
+	temp_path_(TempPath(path)),
+	out_(temp_path_, std::ios::binary | std::ios::trunc),
+	header_(),
+	finished_(false)
+{
+	if (!out_) {
+		throw InvalidSystemFile{};
+	}
+	std::memcpy(header_.magic, SYSTEM_FILE_MAGIC, sizeof(header_.magic));
+	header_.version = SYSTEM_FILE_VERSION;
+	header_.k = static_cast<uint32_t>(k);
+	header_.variable_count = variable_count;
+	header_.entries_offset = sizeof(SystemFileHeader);
+
+	// header is rewritten in Finish, entries are streamed right after it
+	out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	row_offsets_.push_back(0);
+}
+
+SystemWriter::~SystemWriter() {
+	if (!finished_) {
+		out_.close();
+		std::remove(temp_path_.c_str());
+	}
+}
+
+void SystemWriter::Pad() {
+	static const char zeros[8] = {};
+	size_t position = static_cast<size_t>(out_.tellp());
+	out_.write(zeros, (8 - position % 8) % 8);
+}
+
+void SystemWriter::AddRow(EquationType type, long double result) {
+	if (header_.row_count != 0) {
+		row_offsets_.push_back(header_.entry_count);
+	}
+	types_.push_back(static_cast<uint8_t>(type));
+	results_.push_back(static_cast<double>(result));
+	++header_.row_count;
+	hash_.AddRow(type, result);
+}
+
+void SystemWriter::AddCoefitient(size_t index, long double value) {
+	if (header_.row_count == 0 || index >= header_.variable_count) {
+		throw InvalidOperation{};
+	}
+	SystemEntry entry{ static_cast<uint32_t>(index), -1, static_cast<double>(value) };
+	out_.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	++header_.entry_count;
+	hash_.AddCoefitient(index, value);
+}
+
+void SystemWriter::AddLambdaCoefitient(size_t index, long double alpha) {
+	if (header_.row_count == 0 || index >= header_.variable_count) {
+		throw InvalidOperation{};
+	}
+	auto [slot, inserted] = slots_.emplace(static_cast<double>(alpha), static_cast<int32_t>(alphas_.size()));
+	if (inserted) {
+		alphas_.push_back(static_cast<double>(alpha));
+	}
+	SystemEntry entry{ static_cast<uint32_t>(index), slot->second, 0 };
+	out_.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	++header_.entry_count;
+	hash_.AddLambdaCoefitient(index, alpha);
+}
+
+void SystemWriter::Finish() {
+	row_offsets_.push_back(header_.entry_count);
+	header_.slot_count = alphas_.size();
+	header_.source_hash = hash_.Value();
+
+	header_.row_offsets_offset = static_cast<uint64_t>(out_.tellp());
+	out_.write(reinterpret_cast<const char*>(row_offsets_.data()), row_offsets_.size() * sizeof(uint64_t));
+
+	header_.results_offset = static_cast<uint64_t>(out_.tellp());
+	out_.write(reinterpret_cast<const char*>(results_.data()), results_.size() * sizeof(double));
+
+	header_.alphas_offset = static_cast<uint64_t>(out_.tellp());
+	out_.write(reinterpret_cast<const char*>(alphas_.data()), alphas_.size() * sizeof(double));
+
+	header_.types_offset = static_cast<uint64_t>(out_.tellp());
+	out_.write(reinterpret_cast<const char*>(types_.data()), types_.size());
+	Pad();
+
+	header_.file_size = static_cast<uint64_t>(out_.tellp());
+	out_.seekp(0);
+	out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	out_.close();
+	if (!out_) {
+		throw InvalidSystemFile{};
+	}
+
+	// readers never see a half written file
+	if (!AtomicRename(temp_path_, path_)) {
+		throw InvalidSystemFile{};
+	}
+	finished_ = true;
+}
+
+MappedSystem::MappedSystem(const std::string& path) : file_(nullptr), mapping_(nullptr), data_(nullptr), header_() {
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw InvalidSystemFile{};
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	size = static_cast<size_t>(file_size.QuadPart);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		throw InvalidSystemFile{};
+	}
+	file_ = file;
+	mapping_ = mapping;
+	data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		throw InvalidSystemFile{};
+	}
+	struct stat file_stat;
+	fstat(file, &file_stat);
+	size = static_cast<size_t>(file_stat.st_size);
+	void* data = size < sizeof(SystemFileHeader) ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	data_ = data == MAP_FAILED ? nullptr : static_cast<const char*>(data);
+	mapping_ = reinterpret_cast<void*>(size);
+#endif
+	if (data_ == nullptr || size < sizeof(SystemFileHeader)) {
+		Unmap();
+		throw InvalidSystemFile{};
+	}
+
+	std::memcpy(&header_, data_, sizeof(header_));
+	if (std::memcmp(header_.magic, SYSTEM_FILE_MAGIC, sizeof(header_.magic)) != 0 ||
+		header_.version != SYSTEM_FILE_VERSION ||
+		header_.file_size != size ||
+		header_.entries_offset + header_.entry_count * sizeof(SystemEntry) > size ||
+		header_.row_offsets_offset + (header_.row_count + 1) * sizeof(uint64_t) > size ||
+		header_.results_offset + header_.row_count * sizeof(double) > size ||
+		header_.alphas_offset + header_.slot_count * sizeof(double) > size ||
+		header_.types_offset + header_.row_count > size) {
+		Unmap();
+		throw InvalidSystemFile{};
+	}
+
+	// the solvers index by the entries without checks
+	const uint64_t* row_offsets = RowOffsets();
+	bool valid = row_offsets[0] == 0 && row_offsets[header_.row_count] == header_.entry_count;
+	for (size_t row = 0; valid && row < header_.row_count; ++row) {
+		valid = row_offsets[row] <= row_offsets[row + 1];
+	}
+	const SystemEntry* entries = Entries();
+	for (size_t i = 0; valid && i < header_.entry_count; ++i) {
+		valid = entries[i].column < header_.variable_count &&
+			entries[i].slot >= -1 && (entries[i].slot < 0 || static_cast<uint64_t>(entries[i].slot) < header_.slot_count);
+	}
+	if (!valid) {
+		Unmap();
+		throw InvalidSystemFile{};
+	}
+}
+
+MappedSystem::MappedSystem(MappedSystem&& other) noexcept :
+	file_(other.file_),
+	mapping_(other.mapping_),
+	data_(other.data_),
+	header_(other.header_)
+{
+	other.file_ = nullptr;
+	other.mapping_ = nullptr;
+	other.data_ = nullptr;
+}
+
+MappedSystem::~MappedSystem() {
+	Unmap();
+}
+
+void MappedSystem::Unmap() {
+#ifdef _WIN32
+	if (data_ != nullptr) {
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_ != nullptr) {
+		CloseHandle(static_cast<HANDLE>(mapping_));
+	}
+	if (file_ != nullptr) {
+		CloseHandle(static_cast<HANDLE>(file_));
+	}
+#else
+	if (data_ != nullptr) {
+		munmap(const_cast<char*>(data_), reinterpret_cast<size_t>(mapping_));
+	}
+#endif
+	data_ = nullptr;
+	mapping_ = nullptr;
+	file_ = nullptr;
+}
+
+size_t MappedSystem::GetK() const {
+	return header_.k;
+}
+
+size_t MappedSystem::VariableCount() const {
+	return static_cast<size_t>(header_.variable_count);
+}
+
+size_t MappedSystem::RowCount() const {
+	return static_cast<size_t>(header_.row_count);
+}
+
+size_t MappedSystem::SlotCount() const {
+	return static_cast<size_t>(header_.slot_count);
+}
+
+uint64_t MappedSystem::SourceHash() const {
+	return header_.source_hash;
+}
+
+const SystemEntry* MappedSystem::Entries() const {
+	return reinterpret_cast<const SystemEntry*>(data_ + header_.entries_offset);
+}
+
+const uint64_t* MappedSystem::RowOffsets() const {
+	return reinterpret_cast<const uint64_t*>(data_ + header_.row_offsets_offset);
+}
+
+const double* MappedSystem::Results() const {
+	return reinterpret_cast<const double*>(data_ + header_.results_offset);
+}
+
+const double* MappedSystem::Alphas() const {
+	return reinterpret_cast<const double*>(data_ + header_.alphas_offset);
+}
+
+const uint8_t* MappedSystem::Types() const {
+	return reinterpret_cast<const uint8_t*>(data_ + header_.types_offset);
+}
+
+std::vector<Equation<long double> > MappedSystem::Generate(long double lambda) const {
+	return Generate(lambda, RowCount());
+}
+
+std::vector<Equation<long double> > MappedSystem::GenerateCore(long double lambda) const {
+	return Generate(lambda, RowCount() - (VariableCount() - 1));
+}
+
+std::vector<Equation<long double> > MappedSystem::Generate(long double lambda, size_t row_count) const {
+	std::vector<long double> slot_values(SlotCount());
+	for (size_t slot = 0; slot < SlotCount(); ++slot) {
+		slot_values[slot] = -std::pow(lambda, -static_cast<long double>(Alphas()[slot]));
+	}
+
+	const SystemEntry* entries = Entries();
+	const uint64_t* row_offsets = RowOffsets();
+
+	std::vector<Equation<long double> > generated_system;
+	generated_system.reserve(row_count);
+	for (size_t row = 0; row < row_count; ++row) {
+		std::vector<long double> coefitients = std::vector<long double>(VariableCount());
+		for (uint64_t i = row_offsets[row]; i < row_offsets[row + 1]; ++i) {
+			if (entries[i].slot < 0) {
+				coefitients[entries[i].column] = entries[i].value;
+			} else {
+				coefitients[entries[i].column] = slot_values[entries[i].slot];
+			}
+		}
+		generated_system.emplace_back(coefitients, Results()[row], static_cast<EquationType>(Types()[row]));
+	}
+	return generated_system;
+}
+
+bool AtomicRename(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+std::string TempPath(const std::string& path) {
+#ifdef _WIN32
+	unsigned long pid = GetCurrentProcessId();
+#else
+	unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+	return path + "." + std::to_string(pid) + ".tmp";
+}
+
+bool SystemFileMatches(const std::string& path, uint64_t source_hash) {
+	try {
+		return MappedSystem(path).SourceHash() == source_hash;
+	} catch (InvalidSystemFile&) {
+		return false;
+	}
+}
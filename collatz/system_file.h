@@ -0,0 +1,147 @@
+#pragma once
+
+#include "linear_solver.h"
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+
+// Binary layout of a stored system (version 2), all sections 8-byte aligned:
+//   SystemFileHeader
+//   SystemEntry    entries[entry_count]       -- CSR values, row by row
+//   uint64_t       row_offsets[row_count + 1] -- CSR row pointers into entries
+//   double         results[row_count]
+//   double         alphas[slot_count]         -- lambda slots, coefitient = -pow(lambda, -alpha)
+//   uint8_t        types[row_count]           -- EquationType of every row
+
+#define SYSTEM_FILE_VERSION 2
+
+class InvalidSystemFile : std::logic_error {
+public:
+	InvalidSystemFile() : std::logic_error("InvalidSystemFile") {}
+};
+
+struct SystemFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t k;
+	uint64_t variable_count;
+	uint64_t row_count;
+	uint64_t entry_count;
+	uint64_t slot_count;
+	uint64_t entries_offset;
+	uint64_t row_offsets_offset;
+	uint64_t results_offset;
+	uint64_t alphas_offset;
+	uint64_t types_offset;
+	uint64_t file_size;
+	uint64_t source_hash;  // SystemHash of the rows, a cache is rewritten when it differs
+};
+
+struct SystemEntry {
+	uint32_t column;
+	int32_t slot;    // -1 for a constant coefitient, otherwise index into alphas
+	double value;
+};
+
+// receiver of a system row by row: AddRow starts a row, its coefitients follow
+class RowSink {
+public:
+	virtual ~RowSink() = default;
+
+	virtual void AddRow(EquationType type, long double result) = 0;
+	virtual void AddCoefitient(size_t index, long double value) = 0;
+	// coefitient -pow(lambda, -alpha)
+	virtual void AddLambdaCoefitient(size_t index, long double alpha) = 0;
+};
+
+// FNV-1a hash of the rows in their stored precision, so a changed ALPHA, MU or
+// equation gives a different value
+class SystemHash : public RowSink {
+private:
+	uint64_t value_;
+
+	void Add(const void* data, size_t size);
+
+public:
+	SystemHash();
+
+	void AddRow(EquationType type, long double result) override;
+	void AddCoefitient(size_t index, long double value) override;
+	void AddLambdaCoefitient(size_t index, long double alpha) override;
+
+	uint64_t Value() const;
+};
+
+class SystemWriter : public RowSink {
+private:
+	std::string path_;
+	std::string temp_path_;  // per process, two runs writing the same cache do not share it
+	std::ofstream out_;
+	SystemFileHeader header_;
+	std::vector<uint64_t> row_offsets_;
+	std::vector<double> results_;
+	std::vector<uint8_t> types_;
+	std::vector<double> alphas_;
+	std::map<double, int32_t> slots_;
+	SystemHash hash_;
+	bool finished_;
+
+	void Pad();
+
+public:
+	SystemWriter(const std::string& path, size_t k, size_t variable_count);
+	~SystemWriter();
+
+	SystemWriter(const SystemWriter&) = delete;
+	SystemWriter& operator=(const SystemWriter&) = delete;
+
+	void AddRow(EquationType type, long double result) override;
+	void AddCoefitient(size_t index, long double value) override;
+	void AddLambdaCoefitient(size_t index, long double alpha) override;
+
+	void Finish();
+};
+
+class MappedSystem {
+private:
+	void* file_;
+	void* mapping_;
+	const char* data_;
+	SystemFileHeader header_;
+
+	void Unmap();
+	std::vector<Equation<long double> > Generate(long double lambda, size_t row_count) const;
+
+public:
+	MappedSystem(const std::string& path);
+	~MappedSystem();
+
+	MappedSystem(const MappedSystem&) = delete;
+	MappedSystem& operator=(const MappedSystem&) = delete;
+	MappedSystem(MappedSystem&& other) noexcept;
+
+	size_t GetK() const;
+	size_t VariableCount() const;
+	size_t RowCount() const;
+	size_t SlotCount() const;
+	uint64_t SourceHash() const;
+
+	const SystemEntry* Entries() const;
+	const uint64_t* RowOffsets() const;
+	const double* Results() const;
+	const double* Alphas() const;
+	const uint8_t* Types() const;
+
+	std::vector<Equation<long double> > Generate(long double lambda) const;
+	// all rows but the ladder, which FunctionalSystem::Store writes last
+	// (one row per variable except x0)
+	std::vector<Equation<long double> > GenerateCore(long double lambda) const;
+};
+
+// replaces to with from in one step, an existing to is overwritten
+bool AtomicRename(const std::string& from, const std::string& to);
+// path.<pid>.tmp, the file a process writes before AtomicRename to path
+std::string TempPath(const std::string& path);
+// the file exists, is readable and was written from rows with this SystemHash
+bool SystemFileMatches(const std::string& path, uint64_t source_hash);